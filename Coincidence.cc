@@ -0,0 +1,142 @@
+#include "Coincidence.h"
+
+#include <algorithm>
+#include <bitset>
+#include <iostream>
+#include <string>
+
+std::vector<CoincidenceCluster> findCoincidences(const std::vector<ChannelAnalysis>& channels, double window)
+{
+	// Metto insieme i picchi di tutti i canali e li ordino per tempo di inizio
+	std::vector<ChannelPeak> peaks{};
+	for (std::size_t channel{ 0 }; channel < channels.size(); channel++)
+	{
+		const Peaks& channelPeaks{ channels[channel].peaks };
+		for (std::size_t i{ 0 }; i < channelPeaks.amount; i++)
+			peaks.push_back({ static_cast<int>(channel), channelPeaks.startTime[i],
+				channelPeaks.endTime[i], channels[channel].charges[i] });
+	}
+	std::sort(peaks.begin(), peaks.end(),
+		[](const ChannelPeak& a, const ChannelPeak& b) { return a.startTime < b.startTime; });
+
+	// Un picco entra nel gruppo corrente se inizia entro la finestra dal
+	// primo picco del gruppo, altrimenti ne apre uno nuovo
+	std::vector<CoincidenceCluster> clusters{};
+	for (const ChannelPeak& peak : peaks)
+	{
+		if (clusters.empty() || peak.startTime - clusters.back().startTime > window)
+		{
+			clusters.emplace_back();
+			clusters.back().startTime = peak.startTime;
+			clusters.back().endTime = peak.endTime;
+		}
+
+		CoincidenceCluster& cluster{ clusters.back() };
+		cluster.endTime = std::max(cluster.endTime, peak.endTime);
+		cluster.channelMask |= 1u << peak.channel;
+		cluster.maximumCharge = std::max(cluster.maximumCharge, peak.charge);
+		cluster.peaks.push_back(peak);
+	}
+
+	for (CoincidenceCluster& cluster : clusters)
+		cluster.multiplicity = static_cast<int>(std::bitset<32>(cluster.channelMask).count());
+
+	return clusters;
+}
+
+CoincidenceHistograms::CoincidenceHistograms(const AnalysisConfig& config) :
+	m_config{ config },
+	m_clusterConfig{ config },
+	m_coincidence(config, "_Coincidenza"),
+	m_recovered("h_TimeDifference_Recuperati", "Eventi recuperati dalle coincidenze;Tempo [ns];Eventi",
+		config.timeBins, 0, config.maximumTimeDifference),
+	m_multiplicity("h_Molteplicita", "Canali in coincidenza;Canali;Gruppi", g_v1720Channels, 0.5, g_v1720Channels + 0.5),
+	m_delay("h_RitardoCoincidenza", "Ritardo rispetto al primo picco del gruppo;Ritardo [ns];Picchi",
+		200, 0, config.coincidenceWindow)
+{
+	m_clusterConfig.minimumCharge = config.coincidenceCharge;
+}
+
+void CoincidenceHistograms::fill(const std::vector<ChannelAnalysis>& channels, bool ch1Ambiguous)
+{
+	// Stessa analisi del CH1 ripetuta su ogni canale
+	while (m_channelHistograms.size() < channels.size())
+		m_channelHistograms.push_back(std::make_unique<DecayHistograms>(m_config,
+			"_CH" + std::to_string(m_channelHistograms.size())));
+
+	for (std::size_t channel{ 0 }; channel < channels.size(); channel++)
+	{
+		const ChannelAnalysis& analysis{ channels[channel] };
+		if (analysis.peaks.amount < 2)
+			continue;
+
+		const double timeDifference{ analysis.peaks.startTime[1] - analysis.peaks.endTime[0] };
+		if (acceptEvent(m_config, analysis.peaks.amount, timeDifference, analysis.charges[0]))
+		{
+			DecayHistograms& histograms{ *m_channelHistograms[channel] };
+			histograms.timeHistogram.Fill(timeDifference);
+			histograms.electronSpectrum.Fill(analysis.charges[1]);
+			histograms.muonSpectrum.Fill(analysis.charges[0]);
+		}
+	}
+
+	// Coincidenze tra i canali
+	const std::vector<CoincidenceCluster> clusters{ findCoincidences(channels, m_config.coincidenceWindow) };
+	for (const CoincidenceCluster& cluster : clusters)
+	{
+		m_multiplicity.Fill(cluster.multiplicity);
+		if (cluster.multiplicity < 2)
+			continue;
+		for (const ChannelPeak& peak : cluster.peaks)
+			m_delay.Fill(peak.startTime - cluster.startTime);
+	}
+
+	// Con i gruppi al posto dei picchi applico gli stessi tagli del CH1, con
+	// la soglia di carica delle coincidenze: il primo gruppo è il muone e il
+	// secondo l'elettrone. Conto solo i gruppi con il CH1 o con abbastanza
+	// canali, altrimenti un picco di rumore su un altro canale scarta l'evento
+	std::vector<const CoincidenceCluster*> signals{};
+	for (const CoincidenceCluster& cluster : clusters)
+	{
+		if ((cluster.channelMask & (1u << 1)) || cluster.multiplicity >= m_config.coincidenceMultiplicity)
+			signals.push_back(&cluster);
+	}
+	if (signals.size() < 2)
+		return;
+	const double timeDifference{ signals[1]->startTime - signals[0]->endTime };
+	if (!acceptEvent(m_clusterConfig, signals.size(), timeDifference, signals[0]->maximumCharge))
+		return;
+
+	m_coincidence.timeHistogram.Fill(timeDifference);
+	m_coincidence.electronSpectrum.Fill(signals[1]->maximumCharge);
+	m_coincidence.muonSpectrum.Fill(signals[0]->maximumCharge);
+	if (ch1Ambiguous)
+	{
+		m_recovered.Fill(timeDifference);
+		m_recoveredEvents++;
+	}
+}
+
+void CoincidenceHistograms::scale(double factor)
+{
+	for (std::unique_ptr<DecayHistograms>& histograms : m_channelHistograms)
+		histograms->scale(factor);
+	m_coincidence.scale(factor);
+	for (TH1D* histogram : { &m_recovered, &m_multiplicity, &m_delay })
+	{
+		histogram->Sumw2();
+		histogram->Scale(factor);
+	}
+}
+
+void CoincidenceHistograms::write()
+{
+	for (std::unique_ptr<DecayHistograms>& histograms : m_channelHistograms)
+		histograms->write();
+	m_coincidence.write();
+	m_recovered.Write();
+	m_multiplicity.Write();
+	m_delay.Write();
+
+	std::cout << "Coincidenze: " << m_recoveredEvents << " eventi recuperati in cui il CH1 era ambiguo\n";
+}
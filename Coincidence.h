@@ -0,0 +1,65 @@
+#ifndef COINCIDENCE_H
+#define COINCIDENCE_H
+
+#include "DaqReader.h"
+
+#include <memory>
+#include <vector>
+
+// Un picco di un canale, con i tempi in ns e la carica in nC
+struct ChannelPeak
+{
+    int channel{};
+    double startTime{};
+    double endTime{};
+    double charge{};
+};
+
+// Gruppo di picchi di uno o più canali che iniziano entro la finestra di
+// coincidenza dal primo picco del gruppo
+struct CoincidenceCluster
+{
+    double startTime{};
+    double endTime{};
+    // Bit accesi per i canali presenti e numero di canali diversi
+    unsigned channelMask{ 0 };
+    int multiplicity{ 0 };
+    // Carica massima tra i picchi del gruppo
+    double maximumCharge{ 0 };
+    std::vector<ChannelPeak> peaks{};
+};
+
+// Unisce i picchi di tutti i canali in gruppi di coincidenza, ordinati nel tempo
+std::vector<CoincidenceCluster> findCoincidences(const std::vector<ChannelAnalysis>& channels, double window);
+
+// Istogrammi dell'analisi multicanale: gli stessi di DecayHistograms per ogni
+// canale, la molteplicità e i ritardi delle coincidenze, e la distribuzione
+// dei tempi ottenuta dai gruppi di coincidenza invece che dal solo CH1
+class CoincidenceHistograms
+{
+public:
+    explicit CoincidenceHistograms(const AnalysisConfig& config);
+
+    // Riempie gli istogrammi con i risultati di un evento. ch1Ambiguous indica
+    // che il solo CH1 non ha esattamente due picchi
+    void fill(const std::vector<ChannelAnalysis>& channels, bool ch1Ambiguous);
+    void scale(double factor);
+    void write();
+
+    // Cancellazione funzioni per ottimizzazione
+    CoincidenceHistograms(const CoincidenceHistograms&) = delete;
+    CoincidenceHistograms& operator=(const CoincidenceHistograms&) = delete;
+
+private:
+    AnalysisConfig m_config{};
+    // Stessi tagli con la soglia di carica delle coincidenze, per i gruppi
+    AnalysisConfig m_clusterConfig{};
+    // Creati quando il canale compare per la prima volta
+    std::vector<std::unique_ptr<DecayHistograms>> m_channelHistograms{};
+    DecayHistograms m_coincidence;
+    TH1D m_recovered;
+    TH1D m_multiplicity;
+    TH1D m_delay;
+    long m_recoveredEvents{ 0 };
+};
+#endif
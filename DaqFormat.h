@@ -0,0 +1,12 @@
+#ifndef DAQFORMAT_H
+#define DAQFORMAT_H
+
+// Costanti del formato dei file .dat, senza dipendenze da ROOT così
+// possono essere usate anche dal produttore di prova
+// Dimensione delle word in bytes, in questo caso sono parole da 32bit
+constexpr int g_dataDimension{ 4 };
+// Numero di word nel primo header
+constexpr int g_firstHeaderWords{ 14 };
+// Dimensione del buffer dell'evento
+constexpr int g_maxBufferSize{ 0x100000 };
+#endif
@@ -0,0 +1,105 @@
+#include "DaqFormat.h"
+#include "ShmRing.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Produttore di prova per la lettura da memoria condivisa: rilegge un file
+// .dat già acquisito e scrive gli eventi nel ring buffer alla frequenza
+// richiesta, come farebbe l'acquisizione vera
+
+// Con Ctrl+C (o SIGTERM) smetto di scrivere ed esco dalle attese, così il
+// distruttore di ShmRing rimuove comunque la memoria condivisa
+volatile std::sig_atomic_t g_stop{ 0 };
+ShmRing* g_ring{ nullptr };
+
+void stopProducer(int)
+{
+    g_stop = 1;
+    if (g_ring)
+        g_ring->interrupt();
+}
+
+int main(int argc, char* argv[])
+{
+    /* Servono il file da rileggere e il nome della memoria condivisa,
+    opzionalmente la frequenza in eventi al secondo (0 per la massima
+    velocità) e la dimensione del ring buffer in MB */
+    if (argc <= 2)
+    {
+        std::cerr << "Uso: " << argv[0] << " dati.dat /nome [eventi/s] [MB]\n";
+        std::exit(1);
+    }
+    const std::string filePath = argv[1];
+    const std::string ringName = argv[2];
+    const double rate = argc > 3 ? std::atof(argv[3]) : 0;
+    const double megabytes = argc > 4 ? std::atof(argv[4]) : 64;
+
+    std::FILE* binaryFile{ std::fopen(filePath.c_str(), "r") };
+    if (!binaryFile)
+    {
+        std::cerr << "Errore in apertura del file.\n";
+        std::exit(1);
+    }
+
+    ShmRing ring(ringName, static_cast<std::size_t>(megabytes * 1024 * 1024));
+    g_ring = &ring;
+    std::signal(SIGINT, stopProducer);
+    std::signal(SIGTERM, stopProducer);
+    std::cout << "Produttore pronto su " << ringName << ", leggere con shm:" << ringName << '\n';
+
+    // Un record è il primo header, i dati delle board e le 4 word di chiusura
+    std::vector<int> record(g_firstHeaderWords + g_maxBufferSize + 4);
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start{ Clock::now() };
+    long events{ 0 };
+
+    bool consumerAttached{ true };
+    while (!g_stop && std::fread(record.data(), g_dataDimension, g_firstHeaderWords, binaryFile) == static_cast<std::size_t>(g_firstHeaderWords))
+    {
+        // Stessa dimensione calcolata da DaqReader::checkFirstHeader
+        const int dataSize{ (record[0] - 28 - 44) / 4 };
+        const std::size_t words{ static_cast<std::size_t>(dataSize) + 4 };
+        if (dataSize <= 0 || dataSize > g_maxBufferSize ||
+            std::fread(record.data() + g_firstHeaderWords, g_dataDimension, words, binaryFile) != words)
+        {
+            std::cerr << "Errore! Evento " << events + 1 << " incompleto o corrotto.\n";
+            break;
+        }
+
+        // Aspetto il momento previsto per questo evento
+        if (rate > 0)
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(events / rate)));
+
+        // Se il consumatore ha smesso di leggere non ha senso continuare
+        if (!ring.write(record.data(), (g_firstHeaderWords + words) * g_dataDimension))
+        {
+            consumerAttached = false;
+            break;
+        }
+        events++;
+    }
+    std::fclose(binaryFile);
+
+    // Aspetto che il consumatore legga tutto prima di rimuovere la memoria
+    // condivisa, a meno che non si sia già staccato o che sia stato interrotto
+    if (consumerAttached && !g_stop)
+        std::cout << "Scritti " << events << " eventi, aspetto il consumatore...\n";
+    consumerAttached = ring.close() && consumerAttached;
+    if (g_stop)
+        std::cout << "Interrotto, rimuovo la memoria condivisa.\n";
+    else if (!consumerAttached)
+        std::cout << "Il consumatore si è staccato prima di leggere tutti gli eventi.\n";
+
+    const double seconds{ std::chrono::duration<double>(Clock::now() - start).count() };
+    std::cout << "Fine: " << events << " eventi in " << seconds << " s ("
+        << (seconds > 0 ? events / seconds : 0) << " eventi/s)\n";
+    return 0;
+}
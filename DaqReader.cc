@@ -1,23 +1,57 @@
 #include "DaqReader.h"
+#include "PeakFinder.h"
+#include "LifetimeFit.h"
+#include "ShmRing.h"
+#include "FeatureCache.h"
+#include "Coincidence.h"
 
 #include "TTree.h"
 #include "TFile.h"
 #include "TGraph.h"
+#include "TGraphErrors.h"
 #include "TH1D.h"
 #include "TMultiGraph.h"
+#include "TParameter.h"
 
 #include <iostream>
+#include <iomanip>
 #include <cstddef>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <limits>
 
-// Costruttore del reader, memorizzo il path e apro il file
+// Prima "parola magica" del primo header
+constexpr int g_firstCheckWord{ 0x17081996 };
+
+static bool isSharedMemory(const std::string& filePath)
+{
+	return filePath.rfind(g_sharedMemoryPrefix, 0) == 0;
+}
+
+// Per la memoria condivisa i file di output prendono il nome della memoria,
+// senza prefisso e senza la barra iniziale
+static std::string outputPath(const std::string& filePath)
+{
+	if (!isSharedMemory(filePath))
+		return filePath;
+	std::string name{ filePath.substr(g_sharedMemoryPrefix.size()) };
+	name.erase(0, name.find_first_not_of('/'));
+	return name;
+}
+
+// Costruttore del reader, memorizzo il path e apro il file o la memoria condivisa
 DaqReader::DaqReader(std::string filePath, int numberOfEvents) :
-	m_filePath{ filePath },
-	m_binaryFile{ std::fopen(filePath.c_str(), "r") },
-	m_events{ numberOfEvents }
+	m_filePath{ outputPath(filePath) },
+	m_binaryFile{ isSharedMemory(filePath) ? nullptr : std::fopen(filePath.c_str(), "r") },
+	m_ring{ isSharedMemory(filePath) ? std::make_unique<ShmRing>(filePath.substr(g_sharedMemoryPrefix.size())) : nullptr },
+	m_events{ numberOfEvents },
+	m_peakFinder{ std::make_unique<DerivativePeakFinder>() }
 {
 	// Controllo se l'apertura ha avuto successo e che non ho un nullptr
-	if (!m_binaryFile)
+	if (!m_binaryFile && !m_ring)
 	{
 		std::cerr << "Errore in apertura del file.\n";
 		std::exit(1);
@@ -38,6 +72,31 @@ DaqReader::~DaqReader()
 	cleanup();
 }
 
+// Il ring buffer lavora in byte, converto in word come fa fread
+std::size_t DaqReader::readWords(int* buffer, std::size_t words)
+{
+	if (m_ring)
+		return m_ring->read(buffer, words * g_dataDimension) / g_dataDimension;
+	return std::fread(buffer, g_dataDimension, words, m_binaryFile);
+}
+
+// Scarto le word con un seek sul file, mentre dal ring buffer devo leggerle
+bool DaqReader::discardWords(std::size_t words)
+{
+	if (m_binaryFile)
+		return std::fseek(m_binaryFile, static_cast<long>(words * g_dataDimension), SEEK_CUR) == 0;
+
+	int dump[1024];
+	while (words > 0)
+	{
+		const std::size_t chunk{ std::min(words, std::size(dump)) };
+		if (readWords(dump, chunk) != chunk)
+			return false;
+		words -= chunk;
+	}
+	return true;
+}
+
 // Helper function per controllare che il primo header (quello inserito ad hoc
 // dalla collaborazione Argo) sia corretto
 // Dopo che ho verificato il header, la funzione restituisce il numero di parole
@@ -45,8 +104,7 @@ DaqReader::~DaqReader()
 int DaqReader::checkFirstHeader(const int* const firstHeader)
 {
 	// Controllo se la prima "parola magica" è corretta
-	constexpr int firstCheckWord{ 0x17081996 };
-	if (firstHeader[2] != firstCheckWord)
+	if (firstHeader[2] != g_firstCheckWord)
 	{
 		std::cerr << "Errore! Non ho trovato la parola magica ma ho trovato: "
 			<< firstHeader[2] << '\n';
@@ -81,9 +139,8 @@ int DaqReader::checkFirstHeader(const int* const firstHeader)
 // Funzione che serve a contare il numero di canali dato il channel mask
 static int computeChannels(int channelMask)
 {
-	constexpr int V1720channels{ 8 };
 	int channels{ 0 };
-	for (int bit{ 0 }; bit < V1720channels; bit++)
+	for (int bit{ 0 }; bit < g_v1720Channels; bit++)
 	{
 		if (((channelMask >> bit) & 0x1) == 1)
 			channels++;
@@ -95,13 +152,13 @@ static int computeChannels(int channelMask)
 void DaqReader::processEventData(const std::size_t dataSize)
 {
 	// Rimuovo i dati dell'evento precedente siccome voglio immagazzinare quelli nuovi
-	m_ADC00_CH0.clear();
-	m_ADC00_CH1.clear();
-	m_ADC00_CH2.clear();
+	for (std::vector<int>& channel : m_ADC00)
+		channel.clear();
+	m_activeChannels = 0;
 
 	int boardData[g_maxBufferSize];
 	// Leggiamo tutti i dati per questo evento
-	const std::size_t boardDataSize{ std::fread(boardData, g_dataDimension, dataSize, m_binaryFile) };
+	const std::size_t boardDataSize{ readWords(boardData, dataSize) };
 
 	// Vediamo se il numero di parole che abbiamo letto è lo stesso di quelle 
 	// che ci aspettiamo
@@ -143,6 +200,19 @@ void DaqReader::processEventData(const std::size_t dataSize)
 			std::exit(1);
 		}
 
+		// Nella word 3 c'è il trigger time tag. Il bit 31 non fa parte del
+		// contatore, quando il valore diminuisce il contatore è ripartito.
+		// Se tra due eventi passano più di ~17 s un rollover non è visibile
+		if (board == 0)
+		{
+			const int triggerTimeTag{ boardData[index + 3] & 0x7fffffff };
+			if (m_currentEvent == 0)
+				m_firstTriggerTimeTag = triggerTimeTag;
+			else if (triggerTimeTag < m_triggerTimeTag)
+				m_triggerRollovers++;
+			m_triggerTimeTag = triggerTimeTag;
+		}
+
 		// Qui inizia la vera e propria fase di sbittaggio
 		const int boardWords{ boardData[index] & 0xfffffff };
 
@@ -150,9 +220,23 @@ void DaqReader::processEventData(const std::size_t dataSize)
 		constexpr int headerWords{ 4 };
 		const int wordsPerChannel{ (static_cast<int>(boardDataSize) - headerWords) / channels };
 
+		if (board == 0)
+		{
+			m_activeChannels = static_cast<std::size_t>(channels);
+			if (m_ADC00.size() < m_activeChannels)
+				m_ADC00.resize(m_activeChannels);
+		}
+
+		// Le prime word di ogni canale sono prima del trigger e servono per il piedistallo
+		const int pedestalWords{ std::min(g_pedestalSamples / 2, wordsPerChannel) };
+
 		// Facciamo il loop su ogni canale della board
 		for (int ichan{ 0 }; ichan < channels; ichan++)
 		{
+			// Somme per il piedistallo, calcolate nello stesso loop dello sbittaggio
+			long pedestalSum{ 0 };
+			long pedestalSquares{ 0 };
+
 			for (int word{ 0 }; word < wordsPerChannel; ++word)
 			{
 				int wordContent{ boardData[index + headerWords + word + ichan * wordsPerChannel] };
@@ -161,24 +245,20 @@ void DaqReader::processEventData(const std::size_t dataSize)
 				int firstSample{ wordContent & 0xfff };
 				int secondSample{ (wordContent >> 16) & 0xfff };
 
-				if (board == 0 && ichan == 0)
-				{
-					m_ADC00_CH0.push_back(firstSample);
-					m_ADC00_CH0.push_back(secondSample);
-				}
-
-				if (board == 0 && ichan == 1)
+				if (word < pedestalWords)
 				{
-					m_ADC00_CH1.push_back(firstSample);
-					m_ADC00_CH1.push_back(secondSample);
+					pedestalSum += firstSample + secondSample;
+					pedestalSquares += firstSample * firstSample + secondSample * secondSample;
 				}
 
-				if (board == 0 && ichan == 2)
+				if (board == 0)
 				{
-					m_ADC00_CH2.push_back(firstSample);
-					m_ADC00_CH2.push_back(secondSample);
+					m_ADC00[ichan].push_back(firstSample);
+					m_ADC00[ichan].push_back(secondSample);
 				}
 			} // end word
+
+			updatePedestal(board, ichan, pedestalSum, pedestalSquares, 2 * pedestalWords);
 		} // end channel
 		// Sposto l'indice del numero di word che ci sono per ogni board
 		index += boardWords;
@@ -187,7 +267,7 @@ void DaqReader::processEventData(const std::size_t dataSize)
 	// Codice di controllo a fine evento, ulteriore controllo per vedere se
 	// la parte 
 	int dump[4];
-	std::fread(dump, g_dataDimension, 4, m_binaryFile);
+	readWords(dump, 4);
 	if ((((dump[0] >> 16) & 0xFFFF) == 0xA1EF) &&
 		(((dump[1] >> 16) & 0xFFFF) == 0xA2EF) &&
 		(((dump[2] >> 16) & 0xFFFF) == 0xA3E0) &&
@@ -198,16 +278,119 @@ void DaqReader::processEventData(const std::size_t dataSize)
 	}
 }
 
+// Il piedistallo è una media mobile esponenziale delle medie dei sample prima
+// del trigger, e il rumore lo stesso per il loro RMS. Nei primi eventi il peso
+// è 1 / (aggiornamenti + 1), cioè una media semplice, finché non scende a
+// g_pedestalWeight. Gli eventi con un impulso prima del trigger vengono esclusi,
+// ma se l'esclusione dura g_pedestalReseedEvents eventi di fila il tracker
+// riparte da zero, altrimenti dopo uno spostamento vero resterebbe bloccato
+void DaqReader::updatePedestal(int board, int channel, long sum, long squares, int samples)
+{
+	if (samples <= 0)
+		return;
+
+	const std::size_t channels{ static_cast<std::size_t>(m_boards) * g_v1720Channels };
+	if (m_pedestals.size() < channels)
+		m_pedestals.resize(channels);
+	ChannelPedestal& current{ m_pedestals[static_cast<std::size_t>(board) * g_v1720Channels + channel] };
+
+	const double mean{ static_cast<double>(sum) / samples };
+	const double rms{ std::sqrt(std::max(0., static_cast<double>(squares) / samples - mean * mean)) };
+
+	// Il +1 evita di scartare tutto quando il rumore è quasi nullo
+	const double tolerance{ g_pedestalOutlier * current.noise + 1 };
+	if (current.updates > 0 && (std::abs(mean - current.pedestal) > tolerance || rms > tolerance))
+	{
+		if (++current.consecutiveRejected < g_pedestalReseedEvents)
+		{
+			current.rejected++;
+			return;
+		}
+		// Con updates a zero l'evento corrente diventa il nuovo punto di partenza
+		current.updates = 0;
+		current.reseeds++;
+	}
+	current.consecutiveRejected = 0;
+
+	const double weight{ std::max(g_pedestalWeight, 1. / (current.updates + 1)) };
+	current.pedestal += weight * (mean - current.pedestal);
+	current.noise += weight * (rms - current.noise);
+	current.updates++;
+
+	if (m_currentEvent % g_pedestalTrendEvents == 0)
+	{
+		current.trendEvent.push_back(m_eventCount);
+		current.trendPedestal.push_back(current.pedestal);
+		current.trendNoise.push_back(current.noise);
+	}
+}
+
+const ChannelPedestal& DaqReader::channelPedestal(int board, int channel)
+{
+	// Se il canale non è ancora stato letto uso i valori predefiniti
+	static const ChannelPedestal defaultPedestal{};
+	const std::size_t channelIndex{ static_cast<std::size_t>(board) * g_v1720Channels + channel };
+	return channelIndex < m_pedestals.size() ? m_pedestals[channelIndex] : defaultPedestal;
+}
+
+// Un grafico per ogni canale letto, con il rumore come barra d'errore
+void DaqReader::writePedestalTrends()
+{
+	for (std::size_t channelIndex{ 0 }; channelIndex < m_pedestals.size(); channelIndex++)
+	{
+		const ChannelPedestal& current{ m_pedestals[channelIndex] };
+		if (current.updates == 0)
+			continue;
+
+		const std::string suffix{ "_B" + std::to_string(channelIndex / g_v1720Channels) +
+			"_CH" + std::to_string(channelIndex % g_v1720Channels) };
+		TGraphErrors trend{};
+		trend.SetName(("g_Pedestal" + suffix).c_str());
+		trend.SetTitle(("Piedistallo" + suffix + ";Evento;Piedistallo [conteggi]").c_str());
+		for (std::size_t point{ 0 }; point < current.trendEvent.size(); point++)
+		{
+			trend.SetPoint(static_cast<int>(point), current.trendEvent[point], current.trendPedestal[point]);
+			trend.SetPointError(static_cast<int>(point), 0, current.trendNoise[point]);
+		}
+		trend.Write();
+
+		std::cout << "Piedistallo" << suffix << ": " << current.pedestal << " +- " << current.noise
+			<< " conteggi, " << current.rejected << " eventi esclusi, " << current.reseeds << " ripartenze\n";
+	}
+}
+
+// Un canale non attivo in questo evento restituisce un vettore vuoto
+const std::vector<int>& DaqReader::GetChannel(int channel)
+{
+	static const std::vector<int> empty{};
+	if (channel < 0 || static_cast<std::size_t>(channel) >= m_activeChannels)
+		return empty;
+	return m_ADC00[static_cast<std::size_t>(channel)];
+}
+
 // Nel caso non ci siano più dati da processare la funzione restituisce falso
 // nel caso siano presenti altri dati, la funzione elabora i dati e li salva
-// nelle variabili dei vari canali (m_ADC00CH0/1/2)
+// nelle variabili dei vari canali (m_ADC00)
 bool DaqReader::processNextEvent()
 {
+	// Controllo il numero di eventi prima di leggere, con la memoria condivisa
+	// la lettura aspetterebbe un evento che non voglio elaborare.
+	// Il limite riguarda gli eventi attraversati, anche quelli saltati
+	if (m_scannedEvents >= m_events)
+		return false;
+
+	// In modalità campionamento salto gli eventi fino al prossimo selezionato
+	if (m_samplingStride > 1)
+	{
+		if (!skipEvents(std::min<long>(m_nextSample, m_events) - m_scannedEvents) || m_scannedEvents >= m_events)
+			return false;
+	}
+
 	// Creo l'array per il primo header e lo salvo
 	int firstHeader[14];
-	std::size_t objectsRead{ std::fread(firstHeader, g_dataDimension, g_firstHeaderWords, m_binaryFile) };
+	std::size_t objectsRead{ readWords(firstHeader, g_firstHeaderWords) };
 	// Controllo che il numero di word sia giusto, ovvero 14
-	if (objectsRead != 14 || m_currentEvent >= m_events)
+	if (objectsRead != 14)
 		return false;
 
 	// Questa funzione controlla il primo header e vede se i dati non siano corrotti
@@ -215,10 +398,94 @@ bool DaqReader::processNextEvent()
 	const int dataSize{ checkFirstHeader(firstHeader) };
 
 	processEventData(static_cast<std::size_t>(dataSize));
+
+	// Primo header, dati e 4 word di chiusura dell'evento
+	const std::size_t eventBytes{ (g_firstHeaderWords + static_cast<std::size_t>(dataSize) + 4) * g_dataDimension };
+	m_bytesRead += static_cast<long long>(eventBytes);
+	m_telemetry.update(GetTriggerTime(), eventBytes);
+	m_lastRecordBytes = static_cast<long>(eventBytes);
+
+	if (m_samplingStride > 1)
+		m_nextSample = sampleInStratum(m_scannedEvents / m_samplingStride + 1);
+
+	m_scannedEvents++;
 	m_currentEvent++;
 	return true;
 }
 
+// Campionamento stratificato: il file è diviso in gruppi di eventi consecutivi
+// e da ognuno ne elaboro uno. Così anche un piccolo campione copre tutto il run
+void DaqReader::setSampling(double fraction, bool random)
+{
+	if (fraction <= 0 || fraction > 1)
+	{
+		std::cerr << "Errore! La frazione di campionamento deve essere in (0, 1].\n";
+		std::exit(1);
+	}
+	m_samplingStride = std::lround(1 / fraction);
+
+	// Si può elaborare solo un evento ogni m_samplingStride: se la frazione
+	// richiesta è lontana da 1 / m_samplingStride (ad esempio 0.4 diventerebbe
+	// 1/3, e sopra 0.67 il campionamento sparirebbe) la rifiuto
+	constexpr double tolerance{ 0.05 };
+	const double effective{ 1. / m_samplingStride };
+	if (std::abs(effective - fraction) > tolerance * fraction)
+	{
+		std::cerr << "Errore! La frazione di campionamento " << fraction << " non è ottenibile: si può elaborare "
+			<< "un evento ogni N, e il più vicino è 1 ogni " << m_samplingStride << " (" << effective << ").\n";
+		std::exit(1);
+	}
+	std::cout << "Campionamento: un evento ogni " << m_samplingStride << ", frazione effettiva " << effective << '\n';
+	m_samplingRandom = random;
+	m_nextSample = sampleInStratum(m_scannedEvents / m_samplingStride);
+}
+
+long DaqReader::sampleInStratum(long stratum)
+{
+	if (!m_samplingRandom)
+		return stratum * m_samplingStride + m_samplingStride / 2;
+	std::uniform_int_distribution<long> offset{ 0, m_samplingStride - 1 };
+	return stratum * m_samplingStride + offset(m_randomGenerator);
+}
+
+// Salta gli eventi leggendo solo il primo header. Se leggo da file e conosco la
+// dimensione dell'ultimo evento provo prima a saltarli tutti con un solo seek,
+// controllando che l'header trovato sia proprio quello dell'evento atteso.
+// Con eventi di dimensione fissa questo evita di leggere gli header saltati
+bool DaqReader::skipEvents(long events)
+{
+	int firstHeader[14];
+	constexpr long headerBytes{ g_firstHeaderWords * g_dataDimension };
+
+	if (events > 1 && m_binaryFile && m_lastRecordBytes > 0)
+	{
+		const long start{ std::ftell(m_binaryFile) };
+		const bool found{ std::fseek(m_binaryFile, events * m_lastRecordBytes, SEEK_CUR) == 0 &&
+			readWords(firstHeader, g_firstHeaderWords) == g_firstHeaderWords &&
+			firstHeader[2] == g_firstCheckWord &&
+			firstHeader[3] == m_eventCount + events + 1 };
+		if (found && std::fseek(m_binaryFile, -headerBytes, SEEK_CUR) == 0)
+		{
+			m_eventCount += static_cast<int>(events);
+			m_scannedEvents += events;
+			return true;
+		}
+		std::fseek(m_binaryFile, start, SEEK_SET);
+	}
+
+	for (long event{ 0 }; event < events; event++)
+	{
+		if (readWords(firstHeader, g_firstHeaderWords) != g_firstHeaderWords)
+			return false;
+		const int dataSize{ checkFirstHeader(firstHeader) };
+		if (!discardWords(static_cast<std::size_t>(dataSize) + 4))
+			return false;
+		m_lastRecordBytes = headerBytes + (dataSize + 4) * g_dataDimension;
+		m_scannedEvents++;
+	}
+	return true;
+}
+
 /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 					Qui finisce la parte dello sbittaggio
 ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -266,6 +533,8 @@ Peaks findPeak(const std::vector<int>& dataY)
 			result.peakStart.push_back(peakStart);
 			result.peakEnd.push_back(peakEnd);
 			result.peakMinimum.push_back(peakMinimum);
+			result.startTime.push_back(sampleToNs(static_cast<int>(peakStart)));
+			result.endTime.push_back(sampleToNs(static_cast<int>(peakEnd)));
 
 			peakEnd = 0;
 			peakStart = 0;
@@ -296,12 +565,15 @@ Peaks findPeak(const std::vector<int>& dataY)
 
 double countToV(double counts)
 {
-	// Offset ottenuto dall'analisi delle ampiezze
-	constexpr int offset{ 2110 };
+	return countToV(counts, g_defaultPedestal);
+}
+
+double countToV(double counts, double pedestal)
+{
 	// il 2 al numeratore è dovuto dal fatto che il range del fADC è di 2Vpp
 	// 2^12 siccome è un convertitore a 12 bit.
 	const double conversionScaleADC{ 2 / (std::pow(2, 12) - 1) };
-	return (counts - offset) * conversionScaleADC;
+	return (counts - pedestal) * conversionScaleADC;
 }
 
 int sampleToNs(int sample)
@@ -311,7 +583,12 @@ int sampleToNs(int sample)
 	return sample * nsPerSample;
 }
 
-double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<int>& data)
+double sampleToNs(double sample)
+{
+	return sample * sampleToNs(1);
+}
+
+double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<int>& data, double pedestal)
 {
 	// Resistenza 
 	constexpr int resistance{ 50 };
@@ -320,53 +597,167 @@ double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<i
 	constexpr double converstionToNs{ 1e9 };
 	double result{ 0 };
 	for (size_t i{ start }; i < end; i++)
-		result += std::abs(countToV((data[i] + data[i + 1]) / 2.));
+		result += std::abs(countToV((data[i] + data[i + 1]) / 2., pedestal));
 
 	return result / resistance * time * converstionToNs;
 }
 
+bool acceptEvent(const AnalysisConfig& config, std::size_t peaks, double timeDifference, double muonIntegral)
+{
+	return peaks == 2 &&
+		timeDifference > config.minimumTimeDifference &&
+		muonIntegral > config.minimumCharge;
+}
+
+// Nel titolo il suffisso "_CH0" diventa " CH0"
+static std::string titleSuffix(const std::string& suffix)
+{
+	return suffix.empty() ? suffix : " " + suffix.substr(1);
+}
+
+DecayHistograms::DecayHistograms(const AnalysisConfig& config, const std::string& suffix) :
+	timeHistogram(("h_TimeDifference" + suffix).c_str(), ("Distribuzione tempi di decadimento" + titleSuffix(suffix) + ";Tempo [ns];Eventi").c_str(),
+		config.timeBins, 0, config.maximumTimeDifference),
+	electronSpectrum(("h_AreaElettrone" + suffix).c_str(), ("Spettro elettrone" + titleSuffix(suffix) + ";Carica [nC];Eventi").c_str(),
+		config.chargeBins, 0, config.maximumCharge),
+	muonSpectrum(("h_AreaMuone" + suffix).c_str(), ("Spettro muone" + titleSuffix(suffix) + ";Carica [nC];Eventi").c_str(),
+		config.chargeBins, 0, config.maximumCharge)
+{
+}
+
+void DecayHistograms::scale(double factor)
+{
+	for (TH1D* histogram : { &timeHistogram, &electronSpectrum, &muonSpectrum })
+	{
+		histogram->Sumw2();
+		histogram->Scale(factor);
+	}
+}
+
+void DecayHistograms::write()
+{
+	muonSpectrum.Write();
+	electronSpectrum.Write();
+	timeHistogram.Write();
+}
+
+// Seleziono il motore dei picchi, se il nome non esiste termino il programma
+void DaqReader::setPeakFinder(const std::string& name)
+{
+	std::unique_ptr<PeakFinder> peakFinder{ makePeakFinder(name) };
+	if (!peakFinder)
+	{
+		std::cerr << "Errore! Motore dei picchi sconosciuto: " << name << '\n';
+		std::exit(1);
+	}
+	m_peakFinder = std::move(peakFinder);
+}
+
+// Ogni canale è un task indipendente: il motore dei picchi non ha stato e i
+// piedistalli vengono solo letti, quindi i task non hanno bisogno di lock.
+// Con un thread per canale la latenza dell'evento non cresce con i canali,
+// ma solo se il lavoro supera il costo di svegliare i thread: con pochi
+// sample i canali vengono analizzati direttamente nel thread chiamante
+const std::vector<ChannelAnalysis>& DaqReader::analyseChannels()
+{
+	m_channelAnalyses.resize(m_activeChannels);
+	const auto analyseChannel = [this](std::size_t channel)
+	{
+		const std::vector<int>& data{ m_ADC00[channel] };
+		ChannelAnalysis& analysis{ m_channelAnalyses[channel] };
+		analysis.peaks = m_peakFinder->find(data);
+
+		const double pedestal{ GetPedestal(0, static_cast<int>(channel)) };
+		analysis.charges.clear();
+		for (std::size_t i{ 0 }; i < analysis.peaks.amount; i++)
+			analysis.charges.push_back(integrateSpectrum(analysis.peaks.peakStart[i], analysis.peaks.peakEnd[i], data, pedestal));
+	};
+
+	std::size_t samples{ 0 };
+	for (std::size_t channel{ 0 }; channel < m_activeChannels; channel++)
+		samples += m_ADC00[channel].size();
+
+	if (samples < g_parallelChannelSamples || m_threadPool.size() == 1)
+	{
+		for (std::size_t channel{ 0 }; channel < m_activeChannels; channel++)
+			analyseChannel(channel);
+	}
+	else
+		m_threadPool.run(m_activeChannels, analyseChannel);
+	return m_channelAnalyses;
+}
+
 // Questa è la funzione che è stata scritta per l'elaborazione dei dati
 int DaqReader::generateRootFile()
 {
 	std::string rootPath{ m_filePath + ".root" };
 	TFile rootFile(rootPath.c_str(), "RECREATE");
 
-	TH1D timeHistogram("h_TimeDifference", "Distribuzione tempi di decadimento;Tempo [ns];Eventi", 500, 0, 10000);
-	TH1D electronSpectrum("h_AreaElettrone", "Spettro elettrone;Carica [nC];Eventi", 1250, 0, 1.25);
-	TH1D muonSpectrum("h_AreaMuone", "Spettro muone;Carica [nC];Eventi", 1250, 0, 1.25);
+	DecayHistograms histograms(m_analysisConfig);
+
+	// Caratteristiche degli eventi per ricostruire gli istogrammi senza rileggere i dati
+	std::unique_ptr<FeatureWriter> features{};
+	if (m_writeFeatures)
+		features = std::make_unique<FeatureWriter>(m_filePath + ".features", m_peakFinder->name());
+
+	// Istogrammi per ogni canale e delle coincidenze
+	std::unique_ptr<CoincidenceHistograms> coincidences{};
+	if (m_multiChannel)
+		coincidences = std::make_unique<CoincidenceHistograms>(m_analysisConfig);
 
 	Peaks peaks{};
-	std::vector<int> data{};
+	// Tempo speso nella ricerca dei picchi, per la latenza media per evento
+	using Clock = std::chrono::steady_clock;
+	double analysisSeconds{ 0 };
 
 	// Loop principale per l'accesso ai dati
 	while (processNextEvent())
 	{
-		data = GetCH1();
-		peaks = findPeak(data);
+		const std::vector<int>& data{ GetChannel(1) };
+		const Clock::time_point analysisStart{ Clock::now() };
+		if (coincidences)
+		{
+			// Tutti i canali vengono analizzati in parallelo, i picchi del CH1
+			// li prendo da qui senza ripetere la ricerca
+			const std::vector<ChannelAnalysis>& channels{ analyseChannels() };
+			peaks = channels.size() > 1 ? channels[1].peaks : Peaks{};
+			coincidences->fill(channels, peaks.amount != 2);
+		}
+		else
+			peaks = m_peakFinder->find(data);
+		analysisSeconds += std::chrono::duration<double>(Clock::now() - analysisStart).count();
+		// Piedistallo aggiornato con questo evento
+		const double pedestal{ GetPedestal(0, 1) };
 
 		// Se non ho almeno due picchi ho un problema con l'evento
 		if (peaks.amount < 2)
 		{
+			if (features)
+			{
+				constexpr double missing{ std::numeric_limits<double>::quiet_NaN() };
+				features->write(m_eventCount, peaks, missing, missing, missing);
+			}
 			std::cerr << "Ho un problema di picchi nell'evento " << GetCurrentEvent() << " lo salto.\n";
 			continue;
 		}
 
 		// Devo controllare di avere almeno due picchi per poter definire timeDifference
-		int timeDifference{ sampleToNs(static_cast<int>(peaks.peakStart[1] - peaks.peakEnd[0])) };
+		double timeDifference{ peaks.startTime[1] - peaks.endTime[0] };
 
 		// Trovo l'area del muone così posso vedere se supera la soglia
-		double muonIntegral{ integrateSpectrum(peaks.peakStart[0], peaks.peakEnd[0], data) };
-
-		// Imposto dei limiti sull'evento per pulire il rumore e migliorare la qualità dei dati
-		constexpr int minimumTimeDifference{ 20 };
-		constexpr double minimumCharge{ 0.2 };
-		if (peaks.amount == 2 &&
-			timeDifference > minimumTimeDifference &&
-			muonIntegral > minimumCharge)
+		double muonIntegral{ integrateSpectrum(peaks.peakStart[0], peaks.peakEnd[0], data, pedestal) };
+
+		double electronIntegral{ integrateSpectrum(peaks.peakStart[1], peaks.peakEnd[1], data, pedestal) };
+
+		if (features)
+			features->write(m_eventCount, peaks, muonIntegral, electronIntegral, timeDifference);
+
+		if (acceptEvent(m_analysisConfig, peaks.amount, timeDifference, muonIntegral))
 		{
-			timeHistogram.Fill(timeDifference);
-			electronSpectrum.Fill(integrateSpectrum(peaks.peakStart[1], peaks.peakEnd[1], data));
-			muonSpectrum.Fill(muonIntegral);
+			histograms.timeHistogram.Fill(timeDifference);
+			m_timeDifferences.push_back(static_cast<float>(timeDifference));
+			histograms.electronSpectrum.Fill(electronIntegral);
+			histograms.muonSpectrum.Fill(muonIntegral);
 		}
 
 		// Genero i grafici per vedere se l'algoritmo trova picchi funziona in maniera corretta 
@@ -376,7 +767,7 @@ int DaqReader::generateRootFile()
 			TGraph dataPoints;
 			for (std::size_t i{ 0 }; i < data.size(); ++i)
 			{
-				dataPoints.AddPoint(sampleToNs(static_cast<int>(i)), countToV(data[i]));
+				dataPoints.AddPoint(sampleToNs(static_cast<int>(i)), countToV(data[i], pedestal));
 			}
 			finalGraph.Add(&dataPoints);
 
@@ -397,9 +788,9 @@ int DaqReader::generateRootFile()
 
 			for (std::size_t i{ 0 }; i < peaks.amount; i++)
 			{
-				startPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakStart[i])), countToV(data[peaks.peakStart[i]]));
-				endPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakEnd[i])), countToV(data[peaks.peakEnd[i]]));
-				minimumPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakMinimum[i])), countToV(data[peaks.peakMinimum[i]]));
+				startPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakStart[i])), countToV(data[peaks.peakStart[i]], pedestal));
+				endPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakEnd[i])), countToV(data[peaks.peakEnd[i]], pedestal));
+				minimumPeakPoints.AddPoint(sampleToNs(static_cast<int>(peaks.peakMinimum[i])), countToV(data[peaks.peakMinimum[i]], pedestal));
 
 				finalGraph.Add(&startPeakPoints);
 				finalGraph.Add(&endPeakPoints);
@@ -410,11 +801,130 @@ int DaqReader::generateRootFile()
 		}
 	}
 
+	if (m_currentEvent > 0)
+		std::cout << "Ricerca dei picchi: " << analysisSeconds / m_currentEvent * 1e6 << " us per evento ("
+			<< (coincidences ? "tutti i canali" : "solo CH1") << ")\n";
+
+	// Fit unbinned della vita media sugli eventi accettati
+	const LifetimeFitResult fit{ fitLifetime(m_timeDifferences, m_analysisConfig.minimumTimeDifference,
+		m_analysisConfig.maximumTimeDifference, m_threadPool) };
+	writeLifetimeFit(fit);
+
+	// Con il campionamento riporto gli istogrammi alla statistica di tutto il file
+	if (m_samplingStride > 1)
+	{
+		const double scale{ GetSamplingScale() };
+		histograms.scale(scale);
+		if (coincidences)
+			coincidences->scale(scale);
+		TParameter<double>("sampling_Scale", scale).Write();
+		std::cout << "Campionamento: elaborati " << m_currentEvent << " eventi su " << m_scannedEvents
+			<< ", istogrammi scalati di " << scale << '\n';
+	}
+
 	// Salvo i grafici sul file root
-	muonSpectrum.Write();
-	electronSpectrum.Write();
-	timeHistogram.Write();
+	writePedestalTrends();
+	if (m_writeTelemetry)
+		m_telemetry.write();
+	histograms.write();
+	if (coincidences)
+		coincidences->write();
 	rootFile.Close();
 
+	if (features)
+		features->close(GetSamplingScale());
+
+	return m_currentEvent;
+}
+
+// Confronto tra i motori di ricerca dei picchi. Tutti i motori vengono eseguiti
+// sulla stessa forma d'onda del CH1, misuro il tempo impiegato da ognuno e
+// confronto i risultati con il primo motore (la derivata), che fa da riferimento
+int DaqReader::benchmarkPeakFinders()
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::string benchPath{ m_filePath + ".bench.root" };
+	TFile benchFile(benchPath.c_str(), "RECREATE");
+
+	const std::vector<std::string> names{ peakFinderNames() };
+	const std::size_t engines{ names.size() };
+
+	std::vector<std::unique_ptr<PeakFinder>> peakFinders{};
+	std::vector<std::unique_ptr<TH1D>> startResiduals{};
+	std::vector<std::unique_ptr<TH1D>> differenceResiduals{};
+	for (const std::string& name : names)
+	{
+		peakFinders.push_back(makePeakFinder(name));
+		startResiduals.push_back(std::make_unique<TH1D>(("h_ResiduoInizio_" + name).c_str(),
+			("Residuo inizio primo picco " + name + ";#Delta t [ns];Eventi").c_str(), 400, -100, 100));
+		differenceResiduals.push_back(std::make_unique<TH1D>(("h_ResiduoDifferenza_" + name).c_str(),
+			("Residuo differenza di tempo " + name + ";#Delta t [ns];Eventi").c_str(), 500, -500, 500));
+		// Gli istogrammi appartengono ai unique_ptr: se restassero registrati nel
+		// file, Close() li cancellerebbe una seconda volta
+		startResiduals.back()->SetDirectory(nullptr);
+		differenceResiduals.back()->SetDirectory(nullptr);
+	}
+
+	// Statistiche raccolte per ogni motore
+	std::vector<double> seconds(engines, 0.);
+	std::vector<long> samePeakAmount(engines, 0);
+	std::vector<Peaks> peaks(engines);
+	long samples{ 0 };
+
+	std::vector<int> data{};
+	while (processNextEvent())
+	{
+		data = GetCH1();
+		samples += static_cast<long>(data.size());
+
+		for (std::size_t engine{ 0 }; engine < engines; engine++)
+		{
+			const Clock::time_point start{ Clock::now() };
+			peaks[engine] = peakFinders[engine]->find(data);
+			seconds[engine] += std::chrono::duration<double>(Clock::now() - start).count();
+		}
+
+		const Peaks& reference{ peaks[0] };
+		for (std::size_t engine{ 0 }; engine < engines; engine++)
+		{
+			const Peaks& current{ peaks[engine] };
+			if (current.amount == reference.amount)
+				samePeakAmount[engine]++;
+
+			// Il confronto dei tempi ha senso solo se entrambi vedono almeno due picchi
+			if (current.amount < 2 || reference.amount < 2)
+				continue;
+			startResiduals[engine]->Fill(current.startTime[0] - reference.startTime[0]);
+			differenceResiduals[engine]->Fill((current.startTime[1] - current.endTime[0]) -
+				(reference.startTime[1] - reference.endTime[0]));
+		}
+	}
+
+	// Tabella riassuntiva: velocità e accordo con il riferimento
+	std::cout << "Benchmark su " << m_currentEvent << " eventi, riferimento: " << names[0] << '\n'
+		<< std::left << std::setw(10) << "Motore"
+		<< std::setw(14) << "Eventi/s"
+		<< std::setw(14) << "MSample/s"
+		<< std::setw(18) << "Stessi picchi %"
+		<< std::setw(24) << "Inizio media/RMS [ns]"
+		<< "Differenza media/RMS [ns]" << '\n';
+	for (std::size_t engine{ 0 }; engine < engines; engine++)
+	{
+		const double time{ seconds[engine] > 0 ? seconds[engine] : 1 };
+		const double agreement{ m_currentEvent > 0 ? 100. * samePeakAmount[engine] / m_currentEvent : 0 };
+		std::cout << std::left << std::setw(10) << names[engine]
+			<< std::setw(14) << static_cast<long>(m_currentEvent / time)
+			<< std::setw(14) << samples / time / 1e6
+			<< std::setw(18) << agreement
+			<< std::setw(24) << (std::to_string(startResiduals[engine]->GetMean()) + " / " +
+				std::to_string(startResiduals[engine]->GetRMS()))
+			<< differenceResiduals[engine]->GetMean() << " / " << differenceResiduals[engine]->GetRMS() << '\n';
+
+		startResiduals[engine]->Write();
+		differenceResiduals[engine]->Write();
+	}
+	benchFile.Close();
+
 	return m_currentEvent;
 }
\ No newline at end of file
@@ -1,23 +1,48 @@
 #ifndef DAQREADER_H
 #define DAQREADER_H
 
+#include "DaqFormat.h"
 #include "TTree.h"
+#include "TH1D.h"
+#include "Telemetry.h"
+#include "ThreadPool.h"
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdio>
+#include <memory>
+#include <random>
 
-// Definizione di costanti globali
-// Dimensione delle word in bytes, in questo caso sono parole da 32bit
-constexpr int g_dataDimension{ 4 };
-// Numero di word nel primo header
-constexpr int g_firstHeaderWords{ 14 };
+// Definizione di costanti globali, quelle del formato dei dati sono in DaqFormat.h
 // Variabile per attivare il print di debug, cambiare in true per avere molte più scritte
 constexpr bool g_debug{ false };
-// Dimensione del buffer dell'evento
-constexpr int g_maxBufferSize{ 0x100000 };
+// Prefisso del percorso per leggere da un ring buffer in memoria condivisa
+constexpr std::string_view g_sharedMemoryPrefix{ "shm:" };
 // Dimensione del sample utilizzando circa 16 us per ogni buffer
 constexpr int g_maxSamples{ 4096 };
+// Numero di canali di una V1720
+constexpr int g_v1720Channels{ 8 };
+// Sotto questo numero di sample per evento (somma su tutti i canali) l'analisi
+// multicanale non usa i thread: un canale di 2048 sample richiede circa 15 us,
+// dello stesso ordine del risveglio di un thread addormentato
+constexpr std::size_t g_parallelChannelSamples{ 8192 };
+// Piedistallo usato quando non è ancora stato misurato, ottenuto dall'analisi delle ampiezze
+constexpr double g_defaultPedestal{ 2110 };
+// Numero di sample prima del trigger usati per misurare il piedistallo
+constexpr int g_pedestalSamples{ 64 };
+// Peso di ogni evento nella media mobile esponenziale del piedistallo
+constexpr double g_pedestalWeight{ 0.01 };
+// Un evento viene escluso se si discosta più di tante volte il rumore
+constexpr double g_pedestalOutlier{ 5 };
+// Dopo tanti eventi esclusi di fila il livello è cambiato davvero (reset della
+// board, salto di temperatura): riparto dalla media dell'evento corrente
+constexpr int g_pedestalReseedEvents{ 50 };
+// Ogni quanti eventi salvo un punto dell'andamento del piedistallo
+constexpr int g_pedestalTrendEvents{ 1000 };
+// Il trigger time tag della V1720 conta a 125 MHz su 31 bit
+constexpr double g_triggerTimeTagNs{ 8 };
+constexpr long long g_triggerTimeTagRollover{ 0x80000000LL };
 
 // Creo un oggetto per immagazzinare gli indici di tutti i picchi
 struct Peaks
@@ -26,7 +51,80 @@ struct Peaks
     std::vector<std::size_t> peakStart{};
     std::vector<std::size_t> peakEnd{};
     std::vector<std::size_t> peakMinimum{};
+    // Tempi di inizio e fine dei picchi in ns, i motori diversi dalla derivata
+    // li calcolano con precisione inferiore al sample
+    std::vector<double> startTime{};
+    std::vector<double> endTime{};
 };
+
+// Tagli e binning dell'analisi finale, i valori predefiniti sono quelli
+// ottenuti dall'analisi dei dati
+struct AnalysisConfig
+{
+    // Limiti sull'evento per pulire il rumore e migliorare la qualità dei dati
+    double minimumTimeDifference{ 20 };
+    double minimumCharge{ 0.2 };
+    // Limite superiore dell'istogramma e della finestra del fit in ns
+    double maximumTimeDifference{ 10000 };
+    int timeBins{ 500 };
+    // Binning degli spettri di carica in nC
+    double maximumCharge{ 1.25 };
+    int chargeBins{ 1250 };
+    // Finestra in ns entro cui picchi di canali diversi sono in coincidenza
+    double coincidenceWindow{ 20 };
+    // Soglia in nC sulla carica massima del gruppo del muone, separata da
+    // quella del CH1 perché i canali hanno guadagni e piedistalli diversi
+    double coincidenceCharge{ 0.2 };
+    // Un gruppo conta come muone o elettrone se contiene il CH1 o almeno
+    // tanti canali diversi, così un picco di rumore isolato non lo conta
+    int coincidenceMultiplicity{ 2 };
+};
+
+// Tagli sull'evento: esattamente due picchi, abbastanza distanti e con un
+// muone sopra soglia
+bool acceptEvent(const AnalysisConfig& config, std::size_t peaks, double timeDifference, double muonIntegral);
+
+// Istogrammi finali dell'analisi, con il binning della configurazione.
+// Il suffisso viene aggiunto ai nomi, ad esempio per gli istogrammi di ogni canale
+struct DecayHistograms
+{
+    explicit DecayHistograms(const AnalysisConfig& config, const std::string& suffix = "");
+
+    // Riporta gli istogrammi alla statistica di tutto il file dopo un campionamento
+    void scale(double factor);
+    void write();
+
+    TH1D timeHistogram;
+    TH1D electronSpectrum;
+    TH1D muonSpectrum;
+};
+
+// Piedistallo e rumore di un canale, aggiornati ad ogni evento durante lo
+// sbittaggio con i sample prima del trigger
+struct ChannelPedestal
+{
+    double pedestal{ g_defaultPedestal };
+    double noise{ 0 };
+    long updates{ 0 };
+    long rejected{ 0 };
+    // Eventi esclusi consecutivi e numero di ripartenze
+    long consecutiveRejected{ 0 };
+    long reseeds{ 0 };
+    // Andamento nel run: numero di evento, piedistallo e rumore
+    std::vector<double> trendEvent{};
+    std::vector<double> trendPedestal{};
+    std::vector<double> trendNoise{};
+};
+
+// Risultato dell'analisi di un canale: picchi e carica di ognuno in nC
+struct ChannelAnalysis
+{
+    Peaks peaks{};
+    std::vector<double> charges{};
+};
+
+class PeakFinder;
+class ShmRing;
 /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
                 Alcune forward declaration per funzioni
 ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -36,10 +134,14 @@ std::vector<int> derivate(const std::vector<int>& data);
 Peaks findPeak(const std::vector<int>& dataY);
 // Conversione tra conteggi fADC e volt
 double countToV(double);
+// Conversione rispetto al piedistallo misurato del canale
+double countToV(double counts, double pedestal);
 // Conversione tra numero del sample e nanosecondi
 int sampleToNs(int time);
+// Conversione per tempi interpolati tra due sample
+double sampleToNs(double time);
 // Integrazione con la regola del trapezio
-double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<int>& data);
+double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<int>& data, double pedestal = g_defaultPedestal);
 
 
 // Oggetto che si occupa della corretta gestione del codice binario e dei vari check.
@@ -48,7 +150,8 @@ double integrateSpectrum(std::size_t start, std::size_t end, const std::vector<i
 class DaqReader
 {
 public:
-    // Costruttore
+    // Costruttore. Se il percorso inizia con "shm:" il resto è il nome della
+    // memoria condivisa da cui leggere gli eventi, ad esempio "shm:/daq"
     DaqReader(std::string pathFile, int numberOfEventsToRead);
     // Distruttore
     ~DaqReader();
@@ -59,35 +162,137 @@ public:
     // Member function per la generazione del file .root con tutta l'annessa 
     int generateRootFile();
 
+    // Tagli e binning usati da generateRootFile
+    void setAnalysisConfig(const AnalysisConfig& config) { m_analysisConfig = config; }
+    // Scrive le caratteristiche di ogni evento nel file .features, per
+    // ricostruire gli istogrammi senza rileggere i dati (vedi FeatureCache.h)
+    void setFeatureOutput(bool enabled) { m_writeFeatures = enabled; }
+
+    // Analizza tutti i canali attivi e cerca le coincidenze, altrimenti solo il CH1
+    void setMultiChannel(bool enabled) { m_multiChannel = enabled; }
+    // Cerca picchi e cariche su tutti i canali attivi dell'evento corrente,
+    // un task per canale sul ThreadPool
+    const std::vector<ChannelAnalysis>& analyseChannels();
+
+    // Seleziona il motore di ricerca dei picchi usato da generateRootFile
+    void setPeakFinder(const std::string& name);
+    // Esegue tutti i motori su ogni evento, misurandone la velocità e
+    // l'accordo con il motore di riferimento. I residui vengono salvati
+    // in un file .bench.root
+    int benchmarkPeakFinders();
+
     // Funzione per l'accesso ai dati
-    std::vector<int> GetCH0() { return m_ADC00_CH0; }
-    std::vector<int> GetCH1() { return m_ADC00_CH1; }
-    std::vector<int> GetCH2() { return m_ADC00_CH2; }
+    std::vector<int> GetCH0() { return GetChannel(0); }
+    std::vector<int> GetCH1() { return GetChannel(1); }
+    std::vector<int> GetCH2() { return GetChannel(2); }
+    // Accesso senza copia a tutti i canali attivi della board 0
+    const std::vector<int>& GetChannel(int channel);
+    int GetChannelCount() { return static_cast<int>(m_activeChannels); }
     int GetCurrentEvent() { return m_currentEvent; }
+    // Trigger time tag della board 0 così come è scritto nei dati
+    int GetTriggerTimeTag() { return m_triggerTimeTag; }
+    // Tempo del trigger in ns dal primo evento elaborato, con i rollover del
+    // contatore. Con il campionamento i rollover tra eventi saltati si perdono
+    double GetTriggerTime()
+    {
+        return (m_triggerTimeTag - m_firstTriggerTimeTag + m_triggerRollovers * g_triggerTimeTagRollover) * g_triggerTimeTagNs;
+    }
+    // Piedistallo e rumore RMS in conteggi di un canale
+    double GetPedestal(int board, int channel) { return channelPedestal(board, channel).pedestal; }
+    double GetNoise(int board, int channel) { return channelPedestal(board, channel).noise; }
+    // Salva l'andamento dei piedistalli nella directory ROOT corrente
+    void writePedestalTrends();
+
+    // Differenze di tempo in ns degli eventi accettati da generateRootFile
+    const std::vector<float>& GetTimeDifferences() { return m_timeDifferences; }
+    // Byte letti dall'inizio del file
+    long long GetBytesRead() { return m_bytesRead; }
+
+    // Eventi attraversati nel file, compresi quelli saltati dal campionamento
+    long GetScannedEvents() { return m_scannedEvents; }
+
+    // Elabora solo una frazione degli eventi, uno per ogni gruppo di 1/fraction
+    // eventi consecutivi: quello centrale, oppure uno a caso se random è vero.
+    // Gli altri eventi vengono saltati senza decodificarli
+    void setSampling(double fraction, bool random);
+    // Fattore per riportare gli istogrammi alla statistica di tutto il file
+    double GetSamplingScale() { return m_currentEvent > 0 ? static_cast<double>(m_scannedEvents) / m_currentEvent : 1; }
+
+    // Intervallo in secondi tra le stampe della telemetria, 0 per disattivarle
+    void setTelemetryInterval(double seconds) { m_telemetry.setPrintInterval(seconds); }
+    // Salva le serie temporali della telemetria nel file .root
+    void setTelemetryOutput(bool enabled) { m_writeTelemetry = enabled; }
 
     // Cancellazione funzioni per ottimizzazione
     DaqReader(const DaqReader&) = delete;
     DaqReader& operator=(const DaqReader&) = delete;
 
 private:
-    // Output canali
-    std::vector<int> m_ADC00_CH0{};
-    std::vector<int> m_ADC00_CH1{};
-    std::vector<int> m_ADC00_CH2{};
+    // Output canali della board 0, i vettori non vengono mai rimossi per
+    // riutilizzare la memoria tra un evento e l'altro
+    std::vector<std::vector<int>> m_ADC00{};
+    std::size_t m_activeChannels{ 0 };
 
     // Member variables per apertura del file binario
     std::string m_filePath{};
     std::FILE* m_binaryFile{ nullptr };
+    // Ring buffer in memoria condivisa, usato al posto del file se presente
+    std::unique_ptr<ShmRing> m_ring{};
 
     // Member variables per l'elaborazione del codice binario
     int m_events{};
     int m_eventCount{};
     int m_currentEvent{ 0 };
+    long m_scannedEvents{ 0 };
+    // Dimensione in byte dell'ultimo evento, per saltare più eventi con un solo seek
+    long m_lastRecordBytes{ 0 };
+
+    // Campionamento: ampiezza dei gruppi di eventi e indice del prossimo evento da elaborare
+    long m_samplingStride{ 1 };
+    bool m_samplingRandom{ false };
+    long m_nextSample{ 0 };
+    std::mt19937 m_randomGenerator{};
     int m_boards{};
 
+    // Trigger time tag e numero di volte che il contatore a 31 bit è ripartito
+    int m_triggerTimeTag{ 0 };
+    int m_firstTriggerTimeTag{ 0 };
+    long long m_triggerRollovers{ 0 };
+    long long m_bytesRead{ 0 };
+
+    // Piedistalli di ogni canale, con indice board * g_v1720Channels + canale
+    std::vector<ChannelPedestal> m_pedestals{};
+
+    // Colonna delle differenze di tempo accettate, usata per il fit unbinned
+    std::vector<float> m_timeDifferences{};
+    // Thread per le elaborazioni in parallelo
+    ThreadPool m_threadPool{};
+
+    // Frequenze di trigger e di lettura
+    Telemetry m_telemetry{};
+    bool m_writeTelemetry{ false };
+    // Motore di ricerca dei picchi
+    std::unique_ptr<PeakFinder> m_peakFinder{};
+    AnalysisConfig m_analysisConfig{};
+    bool m_writeFeatures{ true };
+    // Analisi multicanale, un elemento per ogni canale attivo
+    bool m_multiChannel{ true };
+    std::vector<ChannelAnalysis> m_channelAnalyses{};
+
+    // Aggiorna il piedistallo con le somme dei sample prima del trigger
+    void updatePedestal(int board, int channel, long sum, long squares, int samples);
+    const ChannelPedestal& channelPedestal(int board, int channel);
 
     // Helper member function, non voglio chiamarla
     int checkFirstHeader(const int* const);
+    // Legge dal file o dal ring buffer, restituisce il numero di word lette
+    std::size_t readWords(int* buffer, std::size_t words);
+    // Scarta dati senza leggerli, con un seek se possibile
+    bool discardWords(std::size_t words);
+    // Salta eventi senza decodificarli
+    bool skipEvents(long events);
+    // Sceglie l'evento da elaborare nel gruppo indicato
+    long sampleInStratum(long stratum);
     void processEventData(std::size_t);
 
     // Funzione per pulizia della classe
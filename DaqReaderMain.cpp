@@ -1,4 +1,5 @@
 #include "DaqReader.h"
+#include "FeatureCache.h"
 
 #include "TObject.h"
 #include "TCanvas.h"
@@ -14,6 +15,34 @@
 // Implementiamo la derivata. Per essere meno sensibili alle oscillazioni del segnale
 // utilizziamo la definizione di derivata numerica simmetrica del quarto ordine
 
+// Riconosce le opzioni che cambiano tagli e binning dell'analisi, comuni alla
+// lettura dei dati e alla ricostruzione dal file .features
+static bool parseAnalysisOption(const std::string& option, AnalysisConfig& config)
+{
+    const std::string value{ option.substr(option.find('=') + 1) };
+    if (option.rfind("--tempo-minimo=", 0) == 0)
+        config.minimumTimeDifference = std::atof(value.c_str());
+    else if (option.rfind("--tempo-massimo=", 0) == 0)
+        config.maximumTimeDifference = std::atof(value.c_str());
+    else if (option.rfind("--bin-tempo=", 0) == 0)
+        config.timeBins = std::atoi(value.c_str());
+    else if (option.rfind("--carica-minima=", 0) == 0)
+        config.minimumCharge = std::atof(value.c_str());
+    else if (option.rfind("--carica-massima=", 0) == 0)
+        config.maximumCharge = std::atof(value.c_str());
+    else if (option.rfind("--bin-carica=", 0) == 0)
+        config.chargeBins = std::atoi(value.c_str());
+    else if (option.rfind("--finestra-coincidenza=", 0) == 0)
+        config.coincidenceWindow = std::atof(value.c_str());
+    else if (option.rfind("--carica-coincidenza=", 0) == 0)
+        config.coincidenceCharge = std::atof(value.c_str());
+    else if (option.rfind("--molteplicita-coincidenza=", 0) == 0)
+        config.coincidenceMultiplicity = std::atoi(value.c_str());
+    else
+        return false;
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
     /* Controlliamo che l'utente abbia inserito il giusto numero di variabili,
@@ -23,6 +52,24 @@ int main(int argc, char* argv[])
         std::cerr << "Errore: numero di argomenti insufficiente!\n";
         std::exit(1);
     }
+
+    AnalysisConfig config{};
+
+    // Ricostruzione veloce degli istogrammi dal file .features, senza rileggere i dati
+    if (std::string(argv[1]) == "--ricostruisci")
+    {
+        for (int arg{ 3 }; arg < argc; arg++)
+        {
+            if (!parseAnalysisOption(argv[arg], config))
+            {
+                std::cerr << "Errore: opzione non valida per la ricostruzione " << argv[arg] << '\n';
+                std::exit(1);
+            }
+        }
+        rebuildFromFeatures(argv[2], config);
+        return 0;
+    }
+
     const std::string filePath = argv[1];
 
     // Qui è necessario l'utilizzo di "atoi" in quanto "stoi" non è supportato
@@ -31,7 +78,45 @@ int main(int argc, char* argv[])
     // Instanziamo l'oggetto che ci servità per leggere i dati
     DaqReader reader(filePath, numberOfEvents);
 
-    reader.generateRootFile();
+    // Gli argomenti successivi sono opzioni nella forma --nome o --nome=valore
+    bool benchmark{ false };
+    for (int arg{ 3 }; arg < argc; arg++)
+    {
+        const std::string option{ argv[arg] };
+        const std::string peakFinderOption{ "--picchi=" };
+        const std::string telemetryOption{ "--telemetria=" };
+        const std::string samplingOption{ "--campionamento=" };
+        const std::string randomSamplingOption{ "--campionamento-casuale=" };
+        if (parseAnalysisOption(option, config))
+            continue;
+        else if (option.rfind(peakFinderOption, 0) == 0)
+            reader.setPeakFinder(option.substr(peakFinderOption.size()));
+        else if (option == "--benchmark")
+            benchmark = true;
+        else if (option.rfind(telemetryOption, 0) == 0)
+            reader.setTelemetryInterval(std::atof(option.substr(telemetryOption.size()).c_str()));
+        else if (option == "--telemetria-root")
+            reader.setTelemetryOutput(true);
+        else if (option.rfind(samplingOption, 0) == 0)
+            reader.setSampling(std::atof(option.substr(samplingOption.size()).c_str()), false);
+        else if (option.rfind(randomSamplingOption, 0) == 0)
+            reader.setSampling(std::atof(option.substr(randomSamplingOption.size()).c_str()), true);
+        else if (option == "--senza-features")
+            reader.setFeatureOutput(false);
+        else if (option == "--solo-ch1")
+            reader.setMultiChannel(false);
+        else
+        {
+            std::cerr << "Errore: opzione sconosciuta " << option << '\n';
+            std::exit(1);
+        }
+    }
+    reader.setAnalysisConfig(config);
+
+    if (benchmark)
+        reader.benchmarkPeakFinders();
+    else
+        reader.generateRootFile();
 
     return 0;
 }
@@ -0,0 +1,137 @@
+#include "FeatureCache.h"
+#include "LifetimeFit.h"
+
+#include "TFile.h"
+#include "TParameter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Costanti per riconoscere un file .features valido
+constexpr std::uint32_t g_featureMagic{ 0x46514144 };
+constexpr std::uint32_t g_featureVersion{ 1 };
+
+FeatureWriter::FeatureWriter(const std::string& path, const std::string& peakFinder) :
+	m_file{ std::fopen(path.c_str(), "wb") }
+{
+	if (!m_file)
+	{
+		std::cerr << "Errore in apertura del file " << path << '\n';
+		std::exit(1);
+	}
+	m_header.magic = g_featureMagic;
+	m_header.version = g_featureVersion;
+	m_header.recordSize = sizeof(EventFeatures);
+	m_header.featurePeaks = g_featurePeaks;
+	std::strncpy(m_header.peakFinder, peakFinder.c_str(), sizeof(m_header.peakFinder) - 1);
+
+	// L'header viene riscritto alla chiusura con il numero di eventi
+	std::fwrite(&m_header, sizeof(m_header), 1, m_file);
+}
+
+FeatureWriter::~FeatureWriter()
+{
+	close(m_header.samplingScale);
+}
+
+void FeatureWriter::write(int event, const Peaks& peaks, double muonIntegral, double electronIntegral, double timeDifference)
+{
+	EventFeatures features{};
+	features.event = static_cast<std::uint32_t>(event);
+	features.peakCount = static_cast<std::uint16_t>(std::min<std::size_t>(peaks.amount, std::numeric_limits<std::uint16_t>::max()));
+
+	const std::size_t saved{ std::min<std::size_t>(peaks.amount, g_featurePeaks) };
+	for (std::size_t i{ 0 }; i < saved; i++)
+	{
+		features.peakStart[i] = static_cast<std::uint16_t>(peaks.peakStart[i]);
+		features.peakEnd[i] = static_cast<std::uint16_t>(peaks.peakEnd[i]);
+		features.peakMinimum[i] = static_cast<std::uint16_t>(peaks.peakMinimum[i]);
+	}
+	features.muonIntegral = static_cast<float>(muonIntegral);
+	features.electronIntegral = static_cast<float>(electronIntegral);
+	features.timeDifference = static_cast<float>(timeDifference);
+
+	std::fwrite(&features, sizeof(features), 1, m_file);
+	m_header.events++;
+}
+
+void FeatureWriter::close(double samplingScale)
+{
+	if (!m_file)
+		return;
+	m_header.samplingScale = samplingScale;
+	std::fseek(m_file, 0, SEEK_SET);
+	std::fwrite(&m_header, sizeof(m_header), 1, m_file);
+	std::fclose(m_file);
+	m_file = nullptr;
+}
+
+long rebuildFromFeatures(const std::string& featurePath, const AnalysisConfig& config)
+{
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point start{ Clock::now() };
+
+	std::FILE* featureFile{ std::fopen(featurePath.c_str(), "rb") };
+	if (!featureFile)
+	{
+		std::cerr << "Errore in apertura del file.\n";
+		std::exit(1);
+	}
+
+	FeatureHeader header{};
+	if (std::fread(&header, sizeof(header), 1, featureFile) != 1 ||
+		header.magic != g_featureMagic || header.version != g_featureVersion ||
+		header.recordSize != sizeof(EventFeatures))
+	{
+		std::cerr << "Errore! " << featurePath << " non è un file .features valido.\n";
+		std::exit(1);
+	}
+
+	std::string rootPath{ featurePath + ".root" };
+	TFile rootFile(rootPath.c_str(), "RECREATE");
+	DecayHistograms histograms(config);
+	std::vector<float> timeDifferences{};
+
+	// Leggo i record a blocchi, senza allocazioni per ogni evento
+	constexpr std::size_t blockRecords{ 65536 };
+	std::vector<EventFeatures> block(blockRecords);
+	long events{ 0 };
+	std::size_t recordsRead{};
+	while ((recordsRead = std::fread(block.data(), sizeof(EventFeatures), blockRecords, featureFile)) > 0)
+	{
+		for (std::size_t i{ 0 }; i < recordsRead; i++)
+		{
+			const EventFeatures& features{ block[i] };
+			if (acceptEvent(config, features.peakCount, features.timeDifference, features.muonIntegral))
+			{
+				histograms.timeHistogram.Fill(features.timeDifference);
+				histograms.electronSpectrum.Fill(features.electronIntegral);
+				histograms.muonSpectrum.Fill(features.muonIntegral);
+				timeDifferences.push_back(features.timeDifference);
+			}
+		}
+		events += static_cast<long>(recordsRead);
+	}
+	std::fclose(featureFile);
+
+	ThreadPool pool{};
+	const LifetimeFitResult fit{ fitLifetime(timeDifferences, config.minimumTimeDifference, config.maximumTimeDifference, pool) };
+	writeLifetimeFit(fit);
+
+	if (header.samplingScale != 1)
+	{
+		histograms.scale(header.samplingScale);
+		TParameter<double>("sampling_Scale", header.samplingScale).Write();
+	}
+	histograms.write();
+	rootFile.Close();
+
+	std::cout << "Ricostruiti " << events << " eventi (motore " << header.peakFinder << ") in "
+		<< std::chrono::duration<double>(Clock::now() - start).count() << " s\n";
+	return events;
+}
@@ -0,0 +1,71 @@
+#ifndef FEATURECACHE_H
+#define FEATURECACHE_H
+
+#include "DaqReader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Il file .features contiene un header seguito da un record di dimensione
+// fissa per ogni evento elaborato. Con questi dati gli istogrammi possono
+// essere ricostruiti con tagli e binning diversi senza rileggere il file .dat
+
+// Numero massimo di picchi di cui salvo gli indici, peakCount resta quello vero
+constexpr int g_featurePeaks{ 4 };
+
+struct FeatureHeader
+{
+    std::uint32_t magic{};
+    std::uint32_t version{};
+    std::uint32_t recordSize{};
+    std::uint32_t featurePeaks{};
+    std::uint64_t events{};
+    // Fattore di scala del campionamento del primo passaggio
+    double samplingScale{ 1 };
+    // Motore dei picchi usato nel primo passaggio
+    char peakFinder[16]{};
+};
+
+// Caratteristiche di un evento. Integrali e differenza di tempo sono NaN se
+// l'evento ha meno di due picchi
+struct EventFeatures
+{
+    std::uint32_t event{};
+    std::uint16_t peakCount{};
+    std::uint16_t reserved{};
+    std::uint16_t peakStart[g_featurePeaks]{};
+    std::uint16_t peakEnd[g_featurePeaks]{};
+    std::uint16_t peakMinimum[g_featurePeaks]{};
+    float muonIntegral{};
+    float electronIntegral{};
+    float timeDifference{};
+};
+static_assert(sizeof(EventFeatures) == 44, "Il record del file .features deve essere compatto");
+
+// Scrittura del file .features durante il primo passaggio
+class FeatureWriter
+{
+public:
+    FeatureWriter(const std::string& path, const std::string& peakFinder);
+    ~FeatureWriter();
+
+    // Aggiunge un evento
+    void write(int event, const Peaks& peaks, double muonIntegral, double electronIntegral, double timeDifference);
+    // Aggiorna l'header con il numero di eventi e chiude il file
+    void close(double samplingScale);
+
+    // Cancellazione funzioni per ottimizzazione
+    FeatureWriter(const FeatureWriter&) = delete;
+    FeatureWriter& operator=(const FeatureWriter&) = delete;
+
+private:
+    std::FILE* m_file{ nullptr };
+    FeatureHeader m_header{};
+};
+
+// Ricostruisce gli istogrammi e il fit della vita media dal file .features
+// con nuovi tagli e binning, salvandoli in <file>.root.
+// Restituisce il numero di eventi letti
+long rebuildFromFeatures(const std::string& featurePath, const AnalysisConfig& config);
+#endif
@@ -0,0 +1,147 @@
+#include "LifetimeFit.h"
+
+#include "TMinuit.h"
+#include "TParameter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Dati utilizzati dalla funzione di Minuit, che non può ricevere un contesto.
+// Vengono impostati da fitLifetime per la durata del fit
+namespace
+{
+	struct FitContext
+	{
+		std::vector<float> data{};
+		double low{};
+		double high{};
+		ThreadPool* pool{ nullptr };
+		// Somme parziali di ogni blocco di dati
+		std::vector<double> partialSums{};
+	};
+
+	FitContext s_context{};
+}
+
+// Somma di log(pdf) su un blocco di dati. La pdf, con t misurato dall'inizio
+// della finestra, è (1 - f) exp(-t / tau) / (tau (1 - exp(-w / tau))) + f / w.
+// La riduzione è dichiarata con omp simd; il loop viene vettorizzato, con exp e
+// log di libmvec, solo perché questo file è compilato con -ffast-math (vedi Makefile)
+static double logLikelihoodBlock(const float* const data, std::size_t size,
+	double signalNorm, double inverseLifetime, double backgroundDensity, double low)
+{
+	double sum{ 0 };
+#pragma omp simd reduction(+:sum)
+	for (std::size_t i = 0; i < size; i++)
+		sum += std::log(signalNorm * std::exp(-(data[i] - low) * inverseLifetime) + backgroundDensity);
+	return sum;
+}
+
+static double negativeLogLikelihood(double lifetime, double background)
+{
+	const double width{ s_context.high - s_context.low };
+	const double signalNorm{ (1 - background) / (lifetime * (1 - std::exp(-width / lifetime))) };
+	const double inverseLifetime{ 1 / lifetime };
+	const double backgroundDensity{ background / width };
+
+	// Divido i dati in più blocchi che thread, così il carico resta bilanciato
+	const std::size_t entries{ s_context.data.size() };
+	const std::size_t blocks{ std::min(entries, s_context.pool->size() * 4) };
+	const std::size_t blockSize{ (entries + blocks - 1) / blocks };
+	s_context.partialSums.assign(blocks, 0.);
+
+	s_context.pool->run(blocks, [&](std::size_t block)
+		{
+			const std::size_t begin{ block * blockSize };
+			const std::size_t end{ std::min(begin + blockSize, entries) };
+			if (begin < end)
+				s_context.partialSums[block] = logLikelihoodBlock(s_context.data.data() + begin, end - begin,
+					signalNorm, inverseLifetime, backgroundDensity, s_context.low);
+		});
+
+	// Sommo i blocchi sempre nello stesso ordine, il risultato non dipende dai thread
+	double sum{ 0 };
+	for (double partial : s_context.partialSums)
+		sum += partial;
+	return -sum;
+}
+
+// Funzione chiamata da Minuit, par[0] è la vita media e par[1] la frazione di fondo
+static void minuitFunction(int&, double*, double& value, double* par, int)
+{
+	value = negativeLogLikelihood(par[0], par[1]);
+}
+
+LifetimeFitResult fitLifetime(const std::vector<float>& timeDifferences, double low, double high, ThreadPool& pool)
+{
+	LifetimeFitResult result{};
+
+	// Tengo solo i dati all'interno della finestra
+	s_context.data.clear();
+	for (float time : timeDifferences)
+	{
+		if (time >= low && time <= high)
+			s_context.data.push_back(time);
+	}
+	s_context.low = low;
+	s_context.high = high;
+	s_context.pool = &pool;
+
+	result.entries = s_context.data.size();
+	constexpr std::size_t minimumEntries{ 10 };
+	if (result.entries < minimumEntries)
+	{
+		std::cerr << "Troppi pochi eventi per il fit della vita media: " << result.entries << '\n';
+		return result;
+	}
+
+	// Il valore iniziale della vita media è la media dei tempi nella finestra
+	double mean{ 0 };
+	for (float time : s_context.data)
+		mean += time - low;
+	mean /= static_cast<double>(result.entries);
+
+	TMinuit minuit(2);
+	minuit.SetPrintLevel(-1);
+	minuit.SetFCN(minuitFunction);
+	// Errori a 1 sigma per una -log(likelihood)
+	minuit.SetErrorDef(0.5);
+	minuit.DefineParameter(0, "lifetime", mean, mean / 10, 10, 10 * (high - low));
+	minuit.DefineParameter(1, "background", 0.05, 0.01, 0, 1);
+
+	int error{ 0 };
+	double arguments[2]{ 10000, 0.1 };
+	minuit.mnexcm("MIGRAD", arguments, 2, error);
+	minuit.mnexcm("HESSE", arguments, 1, error);
+
+	minuit.GetParameter(0, result.lifetime, result.lifetimeError);
+	minuit.GetParameter(1, result.background, result.backgroundError);
+
+	double edm{};
+	double errorDef{};
+	int freeParameters{};
+	int parameters{};
+	minuit.mnstat(result.minimumNll, edm, errorDef, freeParameters, parameters, result.status);
+
+	std::cout << "Fit vita media su " << result.entries << " eventi: tau = "
+		<< result.lifetime << " +- " << result.lifetimeError << " ns, fondo = "
+		<< result.background << " +- " << result.backgroundError
+		<< " (stato " << result.status << ")\n";
+
+	s_context.data.clear();
+	s_context.data.shrink_to_fit();
+	s_context.pool = nullptr;
+	return result;
+}
+
+void writeLifetimeFit(const LifetimeFitResult& result)
+{
+	TParameter<double>("fit_Lifetime", result.lifetime).Write();
+	TParameter<double>("fit_LifetimeError", result.lifetimeError).Write();
+	TParameter<double>("fit_Background", result.background).Write();
+	TParameter<double>("fit_BackgroundError", result.backgroundError).Write();
+	TParameter<double>("fit_MinimumNll", result.minimumNll).Write();
+	TParameter<int>("fit_Status", result.status).Write();
+	TParameter<double>("fit_Entries", static_cast<double>(result.entries)).Write();
+}
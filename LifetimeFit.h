@@ -0,0 +1,30 @@
+#ifndef LIFETIMEFIT_H
+#define LIFETIMEFIT_H
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <vector>
+
+// Risultato del fit della vita media, tutti i tempi sono in ns
+struct LifetimeFitResult
+{
+    double lifetime{};
+    double lifetimeError{};
+    // Frazione di eventi di fondo piatto nella finestra del fit
+    double background{};
+    double backgroundError{};
+    // Valore minimo della -log(likelihood)
+    double minimumNll{};
+    // Stato della matrice di covarianza di Minuit, 3 se il fit è andato bene
+    int status{};
+    std::size_t entries{};
+};
+
+// Fit unbinned di massima verosimiglianza delle differenze di tempo con un
+// esponenziale più un fondo piatto, nella finestra [low, high].
+// La likelihood viene calcolata in parallelo sui thread del pool
+LifetimeFitResult fitLifetime(const std::vector<float>& timeDifferences, double low, double high, ThreadPool& pool);
+// Salva il risultato del fit nella directory ROOT corrente
+void writeLifetimeFit(const LifetimeFitResult& result);
+#endif
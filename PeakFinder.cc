@@ -0,0 +1,295 @@
+#include "PeakFinder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// Il motore a derivata è l'algoritmo originale, lo riutilizzo così com'è
+Peaks DerivativePeakFinder::find(const std::vector<int>& data) const
+{
+	return findPeak(data);
+}
+
+float estimateBaseline(const std::vector<int>& data)
+{
+	const std::size_t samples{ std::min(data.size(), static_cast<std::size_t>(g_baselineSamples)) };
+	if (samples == 0)
+		return 0.f;
+
+	float sum{ 0.f };
+	for (std::size_t i{ 0 }; i < samples; i++)
+		sum += static_cast<float>(data[i]);
+	return sum / static_cast<float>(samples);
+}
+
+// Converte la forma d'onda in un segnale positivo rispetto alla baseline.
+// Il loop è scritto senza dipendenze tra iterazioni per essere vettorizzato
+static void invertSignal(const std::vector<int>& data, float baseline, std::vector<float>& signal)
+{
+	const std::size_t n{ data.size() };
+	signal.resize(n);
+	const int* const in{ data.data() };
+	float* const out{ signal.data() };
+	for (std::size_t i{ 0 }; i < n; i++)
+		out[i] = baseline - static_cast<float>(in[i]);
+}
+
+// Aggiunge un picco al risultato
+static void addPeak(Peaks& result, std::size_t start, std::size_t end, std::size_t minimum,
+	double startTime, double endTime)
+{
+	result.amount += 1;
+	result.peakStart.push_back(start);
+	result.peakEnd.push_back(end);
+	result.peakMinimum.push_back(minimum);
+	result.startTime.push_back(startTime);
+	result.endTime.push_back(endTime);
+}
+
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+				Discriminatore a frazione costante
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+// Il segnale bipolare f * s[i] - s[i - d] attraversa lo zero, da positivo a
+// negativo, in un punto del fronte di salita che non dipende dall'ampiezza
+// dell'impulso. Cerco l'attraversamento tra first e last e lo interpolo
+static double cfdCrossing(const std::vector<float>& bipolar, std::size_t first, std::size_t last)
+{
+	for (std::size_t j{ std::max(first, static_cast<std::size_t>(g_cfdDelay + 1)) }; j <= last; j++)
+	{
+		if (bipolar[j - 1] >= 0.f && bipolar[j] < 0.f)
+			return static_cast<double>(j - 1) + bipolar[j - 1] / (bipolar[j - 1] - bipolar[j]);
+	}
+	// Se non trovo l'attraversamento uso l'inizio dell'impulso
+	return static_cast<double>(first);
+}
+
+// Sul fronte di discesa cerco il punto in cui il segnale torna sotto la
+// stessa frazione dell'ampiezza, anche questo interpolato
+static double trailingCrossing(const std::vector<float>& signal, std::size_t maximum, std::size_t end)
+{
+	const float level{ g_cfdFraction * signal[maximum] };
+	for (std::size_t k{ maximum + 1 }; k <= end; k++)
+	{
+		if (signal[k] < level)
+			return static_cast<double>(k - 1) + (signal[k - 1] - level) / (signal[k - 1] - signal[k]);
+	}
+	return static_cast<double>(end);
+}
+
+Peaks CfdPeakFinder::find(const std::vector<int>& data) const
+{
+	Peaks result{};
+	const std::size_t n{ data.size() };
+	if (n <= static_cast<std::size_t>(g_cfdDelay + 1))
+		return result;
+
+	// Buffer riutilizzati tra le chiamate dello stesso thread per evitare allocazioni
+	thread_local std::vector<float> signal{};
+	thread_local std::vector<float> bipolar{};
+
+	invertSignal(data, estimateBaseline(data), signal);
+
+	// Costruzione del segnale bipolare, anche questo loop è vettorizzabile
+	bipolar.assign(n, 0.f);
+	const float* const s{ signal.data() };
+	float* const b{ bipolar.data() };
+	for (std::size_t i{ g_cfdDelay }; i < n; i++)
+		b[i] = g_cfdFraction * s[i] - s[i - g_cfdDelay];
+
+	// Macchina a stati per delimitare gli impulsi. Un impulso inizia quando il
+	// segnale supera la soglia, e finisce quando torna nel rumore oppure,
+	// in caso di pile-up, quando dopo essere sceso sotto la frazione costante
+	// risale di almeno una soglia
+	bool inPulse{ false };
+	bool falling{ false };
+	std::size_t begin{};
+	std::size_t maximum{};
+	std::size_t valley{};
+	std::size_t lastEnd{ 0 };
+
+	auto closePulse = [&](std::size_t end)
+	{
+		const double start{ cfdCrossing(bipolar, begin, std::min(maximum + g_cfdDelay, end)) };
+		const double stop{ trailingCrossing(signal, maximum, end) };
+		addPeak(result, begin, end, maximum, sampleToNs(start), sampleToNs(stop));
+		lastEnd = end;
+		inPulse = false;
+	};
+
+	for (std::size_t i{ 0 }; i < n; i++)
+	{
+		if (!inPulse)
+		{
+			if (signal[i] >= g_amplitudeThreshold)
+			{
+				inPulse = true;
+				falling = false;
+				maximum = i;
+				// Torno indietro fino al rumore per includere tutto il fronte di salita
+				begin = i;
+				while (begin > lastEnd && signal[begin - 1] > g_noiseLevel)
+					begin--;
+			}
+			continue;
+		}
+
+		if (!falling)
+		{
+			if (signal[i] > signal[maximum])
+				maximum = i;
+			else if (signal[i] < g_cfdFraction * signal[maximum])
+			{
+				falling = true;
+				valley = i;
+			}
+		}
+		else
+		{
+			if (signal[i] < signal[valley])
+				valley = i;
+			// Un secondo impulso sulla coda del primo
+			else if (signal[i] > signal[valley] + g_amplitudeThreshold)
+			{
+				closePulse(valley);
+				inPulse = true;
+				falling = false;
+				begin = valley;
+				maximum = i;
+				continue;
+			}
+		}
+
+		if (falling && signal[i] < g_noiseLevel)
+			closePulse(i);
+	}
+
+	if (inPulse)
+		closePulse(n - 1);
+
+	return result;
+}
+
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+					Filtro adattato con template
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+// Il template è una differenza di esponenziali con ampiezza massima pari a 1
+TemplatePeakFinder::TemplatePeakFinder()
+{
+	m_template.resize(g_templateLength);
+	float maximum{ 0.f };
+	for (int k{ 0 }; k < g_templateLength; k++)
+	{
+		const float t{ static_cast<float>(k) };
+		m_template[k] = std::exp(-t / g_templateDecay) - std::exp(-t / g_templateRise);
+		maximum = std::max(maximum, m_template[k]);
+	}
+
+	m_templateNorm = 0.f;
+	for (float& value : m_template)
+	{
+		value /= maximum;
+		m_templateNorm += value * value;
+	}
+}
+
+Peaks TemplatePeakFinder::find(const std::vector<int>& data) const
+{
+	Peaks result{};
+	const std::size_t n{ data.size() };
+	if (n <= static_cast<std::size_t>(g_templateLength + 2))
+		return result;
+
+	thread_local std::vector<float> signal{};
+	thread_local std::vector<float> filter{};
+
+	invertSignal(data, estimateBaseline(data), signal);
+
+	// Correlazione con il template. Il loop esterno è sul template in modo che
+	// quello interno sia vettorizzabile senza riordinare le somme
+	const std::size_t positions{ n - g_templateLength };
+	filter.assign(positions, 0.f);
+	const float* const s{ signal.data() };
+	float* const m{ filter.data() };
+	for (int k{ 0 }; k < g_templateLength; k++)
+	{
+		const float weight{ m_template[k] / m_templateNorm };
+		const float* const shifted{ s + k };
+		for (std::size_t i{ 0 }; i < positions; i++)
+			m[i] += weight * shifted[i];
+	}
+
+	// Il filtro è una stima dell'ampiezza di un impulso che inizia nel sample i.
+	// Un picco è un massimo locale sopra soglia, unico nella finestra di separazione.
+	// Prima raccolgo tutti gli inizi, perché la fine di un picco dipende dal successivo
+	thread_local std::vector<std::size_t> starts{};
+	thread_local std::vector<double> startSamples{};
+	starts.clear();
+	startSamples.clear();
+	for (std::size_t i{ 1 }; i + 1 < positions; i++)
+	{
+		if (m[i] < g_amplitudeThreshold || m[i] <= m[i - 1] || m[i] < m[i + 1])
+			continue;
+
+		const std::size_t low{ i > static_cast<std::size_t>(g_templateSeparation) ? i - g_templateSeparation : 0 };
+		const std::size_t high{ std::min(i + g_templateSeparation, positions - 1) };
+		bool isMaximum{ true };
+		for (std::size_t j{ low }; j <= high && isMaximum; j++)
+			isMaximum = m[j] <= m[i];
+		if (!isMaximum)
+			continue;
+
+		// Interpolazione parabolica con i due punti vicini
+		const float denominator{ m[i - 1] - 2 * m[i] + m[i + 1] };
+		const double delta{ denominator < 0.f ? 0.5 * (m[i - 1] - m[i + 1]) / denominator : 0. };
+		starts.push_back(i);
+		startSamples.push_back(static_cast<double>(i) + delta);
+		i += g_templateSeparation;
+	}
+
+	// Come nel CFD, un impulso finisce quando dopo il massimo torna nel rumore
+	// oppure, in caso di pile-up, all'inizio dell'impulso successivo
+	for (std::size_t peak{ 0 }; peak < starts.size(); peak++)
+	{
+		const std::size_t begin{ starts[peak] };
+		const std::size_t limit{ peak + 1 < starts.size() ? starts[peak + 1] : n - 1 };
+
+		std::size_t minimum{ begin };
+		std::size_t end{ limit };
+		for (std::size_t j{ begin }; j <= limit; j++)
+		{
+			if (signal[j] > signal[minimum])
+				minimum = j;
+			else if (signal[minimum] >= g_amplitudeThreshold && signal[j] < g_noiseLevel)
+			{
+				end = j;
+				break;
+			}
+		}
+
+		addPeak(result, begin, end, minimum, sampleToNs(startSamples[peak]), sampleToNs(static_cast<double>(end)));
+	}
+
+	return result;
+}
+
+/*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+					Selezione del motore
+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+
+std::unique_ptr<PeakFinder> makePeakFinder(const std::string& name)
+{
+	if (name == "derivata")
+		return std::make_unique<DerivativePeakFinder>();
+	if (name == "cfd")
+		return std::make_unique<CfdPeakFinder>();
+	if (name == "template")
+		return std::make_unique<TemplatePeakFinder>();
+	return nullptr;
+}
+
+std::vector<std::string> peakFinderNames()
+{
+	return { "derivata", "cfd", "template" };
+}
@@ -0,0 +1,88 @@
+#ifndef PEAKFINDER_H
+#define PEAKFINDER_H
+
+#include "DaqReader.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parametri dei motori di ricerca dei picchi alternativi alla derivata.
+// Tutte le ampiezze sono in conteggi fADC rispetto alla baseline, con il
+// segnale invertito in modo da avere impulsi positivi. Sono valori iniziali
+// non ancora ottimizzati sui dati: vanno verificati con --benchmark
+// Numero di sample iniziali utilizzati per stimare la baseline dell'evento
+constexpr int g_baselineSamples{ 32 };
+// Soglia in ampiezza per considerare un impulso
+constexpr float g_amplitudeThreshold{ 20.f };
+// Livello sotto al quale il segnale viene considerato rumore e l'impulso finito
+constexpr float g_noiseLevel{ 4.f };
+// Frazione dell'ampiezza utilizzata dal discriminatore a frazione costante
+constexpr float g_cfdFraction{ 0.3f };
+// Ritardo in sample del segnale bipolare del CFD, circa il tempo di salita
+constexpr int g_cfdDelay{ 3 };
+// Lunghezza in sample del template per il filtro adattato
+constexpr int g_templateLength{ 32 };
+// Costanti di tempo di salita e discesa del template in sample
+constexpr float g_templateRise{ 1.5f };
+constexpr float g_templateDecay{ 6.f };
+// Semi-ampiezza della finestra in cui un massimo del filtro deve essere unico
+constexpr int g_templateSeparation{ 4 };
+
+// Interfaccia comune per tutti i motori di ricerca dei picchi. Ogni motore
+// riempie la struttura Peaks con gli indici dei picchi (usati per
+// l'integrazione) e con i tempi di inizio e fine in ns.
+// Le implementazioni non hanno stato modificabile, quindi find() può essere
+// chiamata da più thread contemporaneamente
+class PeakFinder
+{
+public:
+    virtual ~PeakFinder() = default;
+
+    // Cerca i picchi nella forma d'onda
+    virtual Peaks find(const std::vector<int>& data) const = 0;
+    // Nome del motore, lo stesso accettato da makePeakFinder
+    virtual std::string name() const = 0;
+};
+
+// Algoritmo originale a soglia sulla derivata, vedi findPeak
+class DerivativePeakFinder : public PeakFinder
+{
+public:
+    Peaks find(const std::vector<int>& data) const override;
+    std::string name() const override { return "derivata"; }
+};
+
+// Discriminatore a frazione costante digitale con interpolazione lineare
+// dell'attraversamento dello zero, con tempi di precisione inferiore al sample
+class CfdPeakFinder : public PeakFinder
+{
+public:
+    Peaks find(const std::vector<int>& data) const override;
+    std::string name() const override { return "cfd"; }
+};
+
+// Filtro adattato: correlazione della forma d'onda con un template
+// dell'impulso e interpolazione parabolica del massimo
+class TemplatePeakFinder : public PeakFinder
+{
+public:
+    TemplatePeakFinder();
+
+    Peaks find(const std::vector<int>& data) const override;
+    std::string name() const override { return "template"; }
+
+private:
+    // Template normalizzato ad ampiezza massima unitaria
+    std::vector<float> m_template{};
+    // Somma dei quadrati del template, per ottenere l'ampiezza dal filtro
+    float m_templateNorm{};
+};
+
+// Crea il motore con il nome richiesto, restituisce nullptr se non esiste
+std::unique_ptr<PeakFinder> makePeakFinder(const std::string& name);
+// Nomi di tutti i motori disponibili, il primo è quello di riferimento
+std::vector<std::string> peakFinderNames();
+// Stima della baseline come media dei primi g_baselineSamples sample
+float estimateBaseline(const std::vector<int>& data);
+#endif
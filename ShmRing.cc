@@ -0,0 +1,210 @@
+#include "ShmRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Servono atomici a 64 bit senza lock");
+static_assert(std::atomic<bool>::is_always_lock_free, "interrupt() deve poter essere chiamata da un gestore di segnali");
+
+// Costanti per riconoscere un ring buffer valido
+constexpr std::uint32_t g_shmRingMagic{ 0xA0EF1720 };
+constexpr std::uint32_t g_shmRingVersion{ 3 };
+
+// Attesa quando il ring è vuoto o pieno: prima cedo il processore per un
+// po' di giri, poi dormo per non consumare un core intero
+static void waitRing(int& spins)
+{
+	constexpr int yieldSpins{ 1000 };
+	if (spins++ < yieldSpins)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+// Un processo che termina senza distruttore (crash o SIGKILL) non accende
+// nessun flag: controllo che esista ancora. EPERM vuol dire che esiste
+static bool processGone(std::int32_t pid)
+{
+	return pid > 0 && ::kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+}
+
+void ShmRing::map(int descriptor, std::size_t size)
+{
+	void* const memory{ mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) };
+	::close(descriptor);
+	if (memory == MAP_FAILED)
+	{
+		std::cerr << "Errore nella mappatura della memoria condivisa " << m_name << '\n';
+		std::exit(1);
+	}
+	m_mappedSize = size;
+	m_header = static_cast<ShmRingHeader*>(memory);
+	m_data = static_cast<unsigned char*>(memory) + sizeof(ShmRingHeader);
+}
+
+ShmRing::ShmRing(const std::string& name, std::size_t capacity) :
+	m_name{ name },
+	m_owner{ true }
+{
+	const int descriptor{ shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600) };
+	const std::size_t size{ sizeof(ShmRingHeader) + capacity };
+	if (descriptor < 0 || ftruncate(descriptor, static_cast<off_t>(size)) != 0)
+	{
+		std::cerr << "Errore nella creazione della memoria condivisa " << name << '\n';
+		std::exit(1);
+	}
+	map(descriptor, size);
+
+	m_header = new (m_header) ShmRingHeader{};
+	m_header->capacity = capacity;
+	m_header->version = g_shmRingVersion;
+	m_header->producerPid.store(static_cast<std::int32_t>(getpid()), std::memory_order_relaxed);
+	// Il magic per ultimo, il consumatore lo controlla per sapere che il ring è pronto
+	std::atomic_thread_fence(std::memory_order_release);
+	m_header->magic = g_shmRingMagic;
+}
+
+ShmRing::ShmRing(const std::string& name) :
+	m_name{ name }
+{
+	const int descriptor{ shm_open(name.c_str(), O_RDWR, 0600) };
+	struct stat status{};
+	if (descriptor < 0 || fstat(descriptor, &status) != 0 ||
+		static_cast<std::size_t>(status.st_size) < sizeof(ShmRingHeader))
+	{
+		std::cerr << "Errore in apertura della memoria condivisa " << name
+			<< ", il produttore è in esecuzione?\n";
+		std::exit(1);
+	}
+	map(descriptor, static_cast<std::size_t>(status.st_size));
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (m_header->magic != g_shmRingMagic || m_header->version != g_shmRingVersion ||
+		sizeof(ShmRingHeader) + m_header->capacity != m_mappedSize)
+	{
+		std::cerr << "Errore! La memoria condivisa " << name << " non contiene un ring buffer valido.\n";
+		std::exit(1);
+	}
+	m_header->consumerPid.store(static_cast<std::int32_t>(getpid()), std::memory_order_release);
+}
+
+ShmRing::~ShmRing()
+{
+	// Il consumatore avvisa il produttore che non leggerà altro
+	if (m_header && !m_owner)
+		m_header->consumerDetached.store(1, std::memory_order_release);
+	if (m_header)
+		munmap(m_header, m_mappedSize);
+	// Se il produttore non c'è più la memoria condivisa la rimuovo io
+	if (m_owner || m_producerGone)
+		shm_unlink(m_name.c_str());
+}
+
+void ShmRing::interrupt()
+{
+	m_interrupted.store(true, std::memory_order_relaxed);
+}
+
+bool ShmRing::consumerGone()
+{
+	if (m_interrupted.load(std::memory_order_relaxed) ||
+		m_header->consumerDetached.load(std::memory_order_acquire) != 0)
+		return true;
+	return processGone(m_header->consumerPid.load(std::memory_order_acquire));
+}
+
+bool ShmRing::write(const void* data, std::size_t bytes)
+{
+	const std::uint64_t capacity{ m_header->capacity };
+	if (bytes > capacity)
+	{
+		std::cerr << "Errore! Il record di " << bytes << " byte non entra nel ring buffer.\n";
+		std::exit(1);
+	}
+
+	// Solo il produttore modifica head, posso leggerlo senza sincronizzazione
+	const std::uint64_t head{ m_header->head.load(std::memory_order_relaxed) };
+	// Controllo il consumatore anche quando c'è spazio, così smetto di
+	// scrivere subito invece di riempire il ring per nessuno
+	int spins{ 0 };
+	while (true)
+	{
+		if (consumerGone())
+			return false;
+		if (capacity - (head - m_header->tail.load(std::memory_order_acquire)) >= bytes)
+			break;
+		waitRing(spins);
+	}
+
+	// Copio in al massimo due pezzi se il record attraversa la fine del buffer
+	const std::size_t position{ static_cast<std::size_t>(head % capacity) };
+	const std::size_t first{ std::min<std::size_t>(bytes, capacity - position) };
+	std::memcpy(m_data + position, data, first);
+	std::memcpy(m_data, static_cast<const unsigned char*>(data) + first, bytes - first);
+
+	// Pubblico il record solo dopo averlo copiato tutto
+	m_header->head.store(head + bytes, std::memory_order_release);
+	return true;
+}
+
+bool ShmRing::close()
+{
+	m_header->producerDone.store(1, std::memory_order_release);
+	int spins{ 0 };
+	while (m_header->tail.load(std::memory_order_acquire) != m_header->head.load(std::memory_order_relaxed))
+	{
+		if (consumerGone())
+			return false;
+		waitRing(spins);
+	}
+	return true;
+}
+
+std::size_t ShmRing::read(void* data, std::size_t bytes)
+{
+	const std::uint64_t capacity{ m_header->capacity };
+	const std::uint64_t tail{ m_header->tail.load(std::memory_order_relaxed) };
+
+	// Aspetto che i byte siano disponibili. Controllo producerDone, e se il
+	// produttore esiste ancora, prima di head: così se ha finito head è già
+	// quello definitivo. Un record scritto a metà non viene mai pubblicato
+	std::uint64_t available{};
+	int spins{ 0 };
+	while (true)
+	{
+		const bool done{ m_header->producerDone.load(std::memory_order_acquire) != 0 };
+		available = m_header->head.load(std::memory_order_acquire) - tail;
+		if (available >= bytes || done)
+			break;
+		if (processGone(m_header->producerPid.load(std::memory_order_relaxed)))
+		{
+			std::cerr << "Errore! Il produttore di " << m_name << " è terminato senza segnalare la fine dei dati.\n";
+			available = m_header->head.load(std::memory_order_acquire) - tail;
+			m_producerGone = true;
+			break;
+		}
+		waitRing(spins);
+	}
+
+	bytes = std::min<std::size_t>(bytes, available);
+	const std::size_t position{ static_cast<std::size_t>(tail % capacity) };
+	const std::size_t first{ std::min<std::size_t>(bytes, capacity - position) };
+	std::memcpy(data, m_data + position, first);
+	std::memcpy(static_cast<unsigned char*>(data) + first, m_data, bytes - first);
+
+	// Libero lo spazio solo dopo aver copiato i dati
+	m_header->tail.store(tail + bytes, std::memory_order_release);
+	return bytes;
+}
@@ -0,0 +1,75 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Header del ring buffer, si trova all'inizio della memoria condivisa.
+// head e tail contano i byte scritti e letti dall'inizio, quindi non si
+// azzerano mai: la posizione nel buffer è il loro resto rispetto a capacity.
+// Ognuno dei due è scritto da un solo processo, e sono su cache line diverse.
+// Il consumatore registra il suo pid quando si collega e segnala quando si
+// stacca, così il produttore non aspetta per sempre un lettore che non c'è più.
+// Allo stesso modo il consumatore controlla il pid del produttore, che può
+// terminare senza segnalare la fine dei dati
+struct ShmRingHeader
+{
+    std::uint32_t magic{};
+    std::uint32_t version{};
+    std::uint64_t capacity{};
+    alignas(64) std::atomic<std::uint64_t> head{ 0 };
+    alignas(64) std::atomic<std::uint64_t> tail{ 0 };
+    alignas(64) std::atomic<std::uint32_t> producerDone{ 0 };
+    std::atomic<std::int32_t> producerPid{ 0 };
+    std::atomic<std::int32_t> consumerPid{ 0 };
+    std::atomic<std::uint32_t> consumerDetached{ 0 };
+};
+
+// Ring buffer in memoria condivisa POSIX con un solo produttore e un solo
+// consumatore, senza lock. Il produttore scrive record completi e li rende
+// visibili solo alla fine, così il consumatore non vede mai eventi a metà
+class ShmRing
+{
+public:
+    // Costruttore del produttore: crea la memoria condivisa con la capacità
+    // richiesta in byte. Il nome è quello di shm_open, ad esempio "/daq"
+    ShmRing(const std::string& name, std::size_t capacity);
+    // Costruttore del consumatore: si collega a una memoria già creata
+    explicit ShmRing(const std::string& name);
+    ~ShmRing();
+
+    // Produttore: scrive un record, aspettando che ci sia spazio. Restituisce
+    // false senza scrivere se il consumatore si è staccato o se l'attesa è stata interrotta
+    bool write(const void* data, std::size_t bytes);
+    // Produttore: segnala la fine dei dati e aspetta che il consumatore li legga
+    // tutti. Restituisce false se il consumatore si è staccato prima
+    bool close();
+    // Produttore: interrompe le attese di write e close. Usa solo un atomico
+    // senza lock, quindi si può chiamare da un gestore di segnali
+    void interrupt();
+
+    // Consumatore: legge esattamente bytes byte, aspettando che siano scritti.
+    // Restituisce meno byte solo se il produttore ha finito o non esiste più
+    std::size_t read(void* data, std::size_t bytes);
+
+    // Cancellazione funzioni per ottimizzazione
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+private:
+    std::string m_name{};
+    bool m_owner{ false };
+    std::size_t m_mappedSize{ 0 };
+    ShmRingHeader* m_header{ nullptr };
+    unsigned char* m_data{ nullptr };
+    std::atomic<bool> m_interrupted{ false };
+    // Consumatore: il produttore è terminato senza rimuovere la memoria condivisa
+    bool m_producerGone{ false };
+
+    void map(int descriptor, std::size_t size);
+    // Vero se il produttore deve smettere di aspettare il consumatore
+    bool consumerGone();
+};
+#endif
@@ -0,0 +1,110 @@
+#include "Telemetry.h"
+
+#include <iostream>
+#include <iomanip>
+
+Telemetry::Telemetry(double printInterval) :
+	m_printInterval{ printInterval },
+	m_triggerRate("h_TriggerRate", "Frequenza di trigger;Tempo presa dati [s];Frequenza [Hz]", 60, 0, 60),
+	m_readerRate("h_ReaderRate", "Eventi letti;Tempo reale [s];Eventi/s", 60, 0, 60),
+	m_readerThroughput("h_ReaderThroughput", "Dati letti;Tempo reale [s];MB/s", 60, 0, 60),
+	m_interEventTime("h_InterEventTime", "Tempo tra due trigger;#Delta t [ms];Eventi", 1000, 0, 1000)
+{
+	// Gli istogrammi non devono appartenere al file aperto in quel momento,
+	// vengono scritti solo quando richiesto
+	for (TH1D* histogram : { &m_triggerRate, &m_readerRate, &m_readerThroughput, &m_interEventTime })
+	{
+		histogram->SetDirectory(nullptr);
+		histogram->SetCanExtend(TH1::kAllAxes);
+	}
+	m_lag.SetName("g_Lag");
+	m_lag.SetTitle("Ritardo della lettura;Tempo reale [s];Ritardo [s]");
+}
+
+double Telemetry::wallSeconds(Clock::time_point now) const
+{
+	return std::chrono::duration<double>(now - m_wallStart).count();
+}
+
+double Telemetry::daqSeconds() const
+{
+	return (m_lastTriggerNs - m_firstTriggerNs) * 1e-9;
+}
+
+void Telemetry::update(double triggerTimeNs, std::size_t bytes)
+{
+	const Clock::time_point now{ Clock::now() };
+	if (!m_started)
+	{
+		m_started = true;
+		m_wallStart = now;
+		m_intervalStart = now;
+		m_firstTriggerNs = triggerTimeNs;
+		m_lastTriggerNs = triggerTimeNs;
+		m_intervalFirstTriggerNs = triggerTimeNs;
+	}
+	else
+	{
+		m_interEventTime.Fill((triggerTimeNs - m_lastTriggerNs) * 1e-6);
+		m_intervalTriggers++;
+	}
+
+	m_lastTriggerNs = triggerTimeNs;
+	m_events++;
+	m_intervalEvents++;
+	m_intervalBytes += bytes;
+
+	const double wall{ wallSeconds(now) };
+	m_triggerRate.Fill(daqSeconds());
+	m_readerRate.Fill(wall);
+	m_readerThroughput.Fill(wall, bytes * 1e-6);
+
+	if (m_printInterval > 0 &&
+		std::chrono::duration<double>(now - m_intervalStart).count() >= m_printInterval)
+		print();
+}
+
+// Il ritardo è la differenza tra il tempo reale e quello della presa dati
+// dall'inizio della lettura: se cresce il reader non sta al passo con il DAQ
+void Telemetry::print()
+{
+	if (!m_started)
+		return;
+
+	const Clock::time_point now{ Clock::now() };
+	const double interval{ std::chrono::duration<double>(now - m_intervalStart).count() };
+	const double daqInterval{ (m_lastTriggerNs - m_intervalFirstTriggerNs) * 1e-9 };
+	const double wall{ wallSeconds(now) };
+	const double lag{ wall - daqSeconds() };
+	m_lag.AddPoint(wall, lag);
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "Telemetria: evento " << m_events
+		<< " | trigger " << (daqInterval > 0 ? m_intervalTriggers / daqInterval : 0) << " Hz"
+		<< " | lettura " << (interval > 0 ? m_intervalEvents / interval : 0) << " eventi/s, "
+		<< (interval > 0 ? m_intervalBytes * 1e-6 / interval : 0) << " MB/s"
+		<< " | ritardo " << lag << " s"
+		<< " | tempo medio tra trigger " << m_interEventTime.GetMean() << " ms\n"
+		<< std::defaultfloat << std::setprecision(6);
+
+	m_intervalStart = now;
+	m_intervalFirstTriggerNs = m_lastTriggerNs;
+	m_intervalEvents = 0;
+	m_intervalTriggers = 0;
+	m_intervalBytes = 0;
+}
+
+void Telemetry::write()
+{
+	// Gli istogrammi contano eventi e MB per bin, divido per la larghezza
+	// del bin (che cresce quando l'asse viene esteso) per avere frequenze
+	m_triggerRate.Scale(1., "width");
+	m_readerRate.Scale(1., "width");
+	m_readerThroughput.Scale(1., "width");
+
+	m_triggerRate.Write();
+	m_readerRate.Write();
+	m_readerThroughput.Write();
+	m_interEventTime.Write();
+	m_lag.Write();
+}
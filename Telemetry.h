@@ -0,0 +1,65 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "TH1D.h"
+#include "TGraph.h"
+
+#include <chrono>
+#include <cstddef>
+
+// Oggetto che tiene traccia del ritmo della presa dati e della lettura.
+// Ad ogni evento riceve il tempo del trigger e i byte letti, e ad intervalli
+// regolari stampa le frequenze calcolate sull'ultimo intervallo.
+// Le serie temporali possono essere salvate nel file .root con write()
+class Telemetry
+{
+public:
+    // Intervallo in secondi tra due stampe, se è 0 non stampo nulla
+    explicit Telemetry(double printInterval = 10);
+
+    // Registra un evento letto
+    void update(double triggerTimeNs, std::size_t bytes);
+    // Stampa le statistiche dell'ultimo intervallo
+    void print();
+    // Salva gli istogrammi nella directory ROOT corrente
+    void write();
+
+    void setPrintInterval(double printInterval) { m_printInterval = printInterval; }
+
+    // Cancellazione funzioni per ottimizzazione
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double m_printInterval{};
+
+    // Origine dei tempi: primo evento letto
+    bool m_started{ false };
+    Clock::time_point m_wallStart{};
+    double m_firstTriggerNs{};
+    double m_lastTriggerNs{};
+    long m_events{ 0 };
+
+    // Contatori dell'intervallo corrente
+    Clock::time_point m_intervalStart{};
+    double m_intervalFirstTriggerNs{};
+    long m_intervalEvents{ 0 };
+    // Intervalli tra trigger consecutivi osservati nell'intervallo corrente
+    long m_intervalTriggers{ 0 };
+    std::size_t m_intervalBytes{ 0 };
+
+    // Serie temporali: frequenza di trigger in funzione del tempo di presa dati,
+    // eventi e MB letti in funzione del tempo reale, e ritardo della lettura
+    TH1D m_triggerRate;
+    TH1D m_readerRate;
+    TH1D m_readerThroughput;
+    TH1D m_interEventTime;
+    TGraph m_lag;
+
+    // Secondi passati dall'inizio per l'orologio reale e per quello della presa dati
+    double wallSeconds(Clock::time_point now) const;
+    double daqSeconds() const;
+};
+#endif
@@ -0,0 +1,71 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+	// Il thread chiamante conta come uno dei thread
+	for (unsigned i{ 1 }; i < threads; i++)
+		m_workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::runTasks(std::unique_lock<std::mutex>& lock)
+{
+	while (m_next < m_tasks)
+	{
+		const std::size_t index{ m_next++ };
+		const std::function<void(std::size_t)>* const task{ m_task };
+		lock.unlock();
+		(*task)(index);
+		lock.lock();
+		if (++m_finished == m_tasks)
+			m_done.notify_all();
+	}
+}
+
+void ThreadPool::work()
+{
+	std::unique_lock<std::mutex> lock{ m_mutex };
+	while (true)
+	{
+		m_wake.wait(lock, [this] { return m_stop || m_next < m_tasks; });
+		if (m_stop)
+			return;
+		runTasks(lock);
+	}
+}
+
+void ThreadPool::run(std::size_t tasks, const std::function<void(std::size_t)>& task)
+{
+	if (tasks == 0)
+		return;
+
+	std::unique_lock<std::mutex> lock{ m_mutex };
+	m_task = &task;
+	m_tasks = tasks;
+	m_next = 0;
+	m_finished = 0;
+	// Sveglio solo i thread che servono: il chiamante esegue già un task
+	const std::size_t helpers{ std::min(tasks - 1, m_workers.size()) };
+	for (std::size_t i{ 0 }; i < helpers; i++)
+		m_wake.notify_one();
+
+	runTasks(lock);
+	m_done.wait(lock, [this] { return m_finished == m_tasks; });
+
+	// Nessun thread deve prendere altri task finché non arriva un nuovo lavoro
+	m_task = nullptr;
+	m_tasks = 0;
+	m_next = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Gruppo di thread creati una sola volta e riutilizzati, così che lavori
+// brevi e ripetuti (come le chiamate di Minuit) non paghino ogni volta la
+// creazione dei thread. Anche il thread che chiama run() esegue i task
+class ThreadPool
+{
+public:
+    // Di default uso tutti i core disponibili
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    // Numero di thread che eseguono i task, compreso quello chiamante
+    std::size_t size() const { return m_workers.size() + 1; }
+
+    // Esegue task(i) per ogni i in [0, tasks) e ritorna quando sono tutti finiti
+    void run(std::size_t tasks, const std::function<void(std::size_t)>& task);
+
+    // Cancellazione funzioni per ottimizzazione
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    std::vector<std::thread> m_workers{};
+    std::mutex m_mutex{};
+    std::condition_variable m_wake{};
+    std::condition_variable m_done{};
+
+    // Lavoro corrente, protetto da m_mutex
+    const std::function<void(std::size_t)>* m_task{ nullptr };
+    std::size_t m_tasks{ 0 };
+    std::size_t m_next{ 0 };
+    std::size_t m_finished{ 0 };
+    bool m_stop{ false };
+
+    // Loop dei thread secondari
+    void work();
+    // Esegue task finché ce ne sono, con il lock preso all'ingresso e all'uscita
+    void runTasks(std::unique_lock<std::mutex>& lock);
+};
+#endif